@@ -30,6 +30,8 @@
  *	THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE	1	// to pick up splice
+
 #include "AsyncIO.h"
 
 #include "CommonUtilities.h"
@@ -49,19 +51,58 @@
 	#define ASYNC_NETIO_USE_SELECT		1
 	#include <FreeRTOS.h>
 	#include <task.h>
+#elif TARGET_OS_LINUX
+	#include <netinet/in.h>
+	#include <sys/socket.h>
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+	#include <sys/sendfile.h>
+	#include <sys/signalfd.h>
+	#include <sys/syscall.h>
+	#include <sys/time.h>
+	#include <sys/uio.h>
+	#include <sys/stat.h>
+	#include <sys/wait.h>
+	#include <signal.h>
+	#define ASYNC_NETIO_USE_MMSG		1		// recvmmsg/sendmmsg
+	#ifndef P_PIDFD
+		#define P_PIDFD					3		// waitid() -- glibc only has it in the enum, when at all
+	#endif
+	#if !ASYNC_NETIO_USE_POLL
+		#define ASYNC_NETIO_USE_EPOLL		1
+		#if __has_include(<linux/io_uring.h>)
+			#include <linux/io_uring.h>
+			#include <sys/mman.h>
+			#define ASYNC_NETIO_USE_IO_URING	1
+		#endif
+	#endif
 #else
 	#include <netinet/in.h>
 	#include <sys/socket.h>
-	#include <sys/event.h>
 	#include <sys/time.h>
+	#include <sys/uio.h>
+	#include <sys/stat.h>
+	#include <sys/wait.h>
 	#include <signal.h>
-	#define ASYNC_NETIO_USE_KQUEUE		1
+	#if !ASYNC_NETIO_USE_POLL
+		#include <sys/event.h>
+		#define ASYNC_NETIO_USE_KQUEUE		1
+	#endif
+#endif
+
+// building with ASYNC_NETIO_USE_POLL=1 swaps kqueue/epoll for plain poll(), for a POSIX system
+//	that has neither -- one pollfd per watched descriptor, kept in a dense array
+#if ASYNC_NETIO_USE_POLL
+	#include <poll.h>
+	#ifndef POLLRDHUP
+		#define POLLRDHUP		0		// Linux only -- elsewhere the read returning 0 has to say it
+	#endif
 #endif
 
 // we may only want to do this selectively, even on Apple --
 //	it's needed to use AsyncIO inside a Cocoa app, which uses it's own runloop
 #if __APPLE__
-#if !TARGET_OS_FREERTOS
+#if !TARGET_OS_FREERTOS && !ASYNC_NETIO_USE_POLL
 #define ASYNC_NETIO_USE_RUN_LOOP		1
 #endif
 #endif
@@ -70,6 +111,11 @@
 #include <CoreFoundation/CoreFoundation.h>
 #endif
 
+#if TARGET_OS_UNIXLIKE
+#include <pthread.h>
+#include <poll.h>
+#endif
+
 
 
 #define kAIO_TYPE_LISTENER			1
@@ -77,9 +123,141 @@
 #define kAIO_TYPE_TIMER				3		// not on RTOS (yet?)
 #define kAIO_TYPE_PROC				4		// process monitor
 #define kAIO_TYPE_SIGNAL			5		// signal monitor
+#define kAIO_TYPE_URING				6		// internal -- the io_uring completion queue
+#define kAIO_TYPE_WAKEUP			7		// internal -- lets other threads interrupt the loop
+#define kAIO_TYPE_DATAGRAM			8
+
+// timers live in a hierarchical timing wheel (one per loop, same on every backend) --
+//	arming and cancelling are O(1), and the loop only needs the next deadline as the
+//	timeout for its wait. Level 0 has 1ms slots, each level up is 64 times coarser, and
+//	entries cascade down a level as their slot comes due. Anything past the top level
+//	(about 4.6 hours out) parks in the last slot and gets re-filed when it cascades.
+// AsyncIOs come out of per-loop slabs, and what the kernel holds onto is a handle (slot index
+//	plus a generation that changes whenever the slot is freed) rather than a pointer -- so an event
+//	that was already queued for something that's since been released just doesn't resolve, even
+//	if the slot has been handed out again
+#define kAsyncIOSlabChunkSize		64
+
+#if UINTPTR_MAX > 0xFFFFFFFFu
+	#define kAsyncIOHandleIndexBits		32
+#else
+	#define kAsyncIOHandleIndexBits		20
+#endif
+#define kAsyncIOHandleIndexMask		( ( (uintptr_t)1 << kAsyncIOHandleIndexBits ) - 1 )
+#define kAsyncIOGenerationMask		( (uint32_t)( UINTPTR_MAX >> kAsyncIOHandleIndexBits ) )
+
+#define kAIOTimerWheelBits			6
+#define kAIOTimerWheelSlots			( 1 << kAIOTimerWheelBits )
+#define kAIOTimerWheelLevels		4
+
+typedef struct AsyncIOTimerEntry	AsyncIOTimerEntry;
+typedef void	(*AsyncIOTimerHandler)( struct OpaqueAsyncIOLoop *loop, AsyncIOTimerEntry *entry );
+
+// embed one of these in anything that needs a timeout
+struct AsyncIOTimerEntry
+{
+	AsyncIOTimerEntry			*next;
+	AsyncIOTimerEntry			**prev;			// NULL when it isn't armed
+	uint64_t					expires;		// milliseconds, AsyncIO_Milliseconds() time base
+	uint16_t					slot;			// level * kAIOTimerWheelSlots + slot
+	AsyncIOTimerHandler			handler;
+};
+
+typedef struct
+{
+	uint64_t					current;		// everything due at or before this has fired
+	uint64_t					occupied[ kAIOTimerWheelLevels ];
+	AsyncIOTimerEntry			*slots[ kAIOTimerWheelLevels * kAIOTimerWheelSlots ];
+} AsyncIOTimerWheel;
+
+// buffered streams (AsyncIO_Read/AsyncIO_Write) -- a ring per direction, allocated the first
+//	time the connection uses them
+#define kAsyncIODefaultStreamBufferSize		16384
+
+typedef struct
+{
+	uint8_t						*data;
+	size_t						size;
+	size_t						head;				// oldest byte
+	size_t						count;
+} AsyncIORing;
+
+typedef struct
+{
+	AsyncIORing					input;				// what the caller's buffer didn't have room for
+	AsyncIORing					output;				// what the kernel didn't take yet
+	int							outputError;		// sticky, reported by the next write
+	bool						inputEOF;
+} AsyncIOStream;
+
+#if TARGET_OS_UNIXLIKE
+// AsyncIO_SendFile() -- the file goes out as the socket has room, after whatever was already queued
+//	ahead of it on the stream, and anything queued after waits for it
+#define kAsyncIOSendFileBurst		( 1024 * 1024 )		// per writability event, so one big file doesn't hog the loop
+
+typedef struct
+{
+	int							fd;
+	off_t						offset;
+	size_t						remaining;
+	off_t						sent;
+	size_t						queuedAhead;
+	bool						full;				// the last pump stopped because the socket was, not at the burst
+	AsyncIOSendFileCompletion	completion;
+	void*						userData;
+} AsyncIOSendFile;
+#endif
+
+#if !ASYNC_NETIO_USE_SELECT
+
+#define kAsyncIODatagramBatchesPerWakeup	8		// so one busy socket doesn't hog the loop
+
+#if ASYNC_NETIO_USE_MMSG
+typedef struct mmsghdr			AsyncIOMsgHdr;
+#else
+// the same shape, so the fallback can loop over recvmsg/sendmsg with the same headers
+typedef struct
+{
+	struct msghdr				msg_hdr;
+	unsigned int				msg_len;
+} AsyncIOMsgHdr;
+#endif
+
+// every packet gets a slot of maxPacket bytes, with its own header and address, all set up once
+//	-- sends are a ring of those slots, and receives reuse the same batchSize slots every time
+typedef struct
+{
+	size_t						maxPacket;
+	int							batchSize;
+
+	uint8_t						*rxBuffers;
+	AsyncIOMsgHdr				*rxHeaders;
+	struct iovec				*rxVectors;
+	struct sockaddr_storage		*rxAddresses;
+	AsyncIODatagram				*received;
+	int							numReceived;		// only inside the callback
+
+	uint8_t						*txBuffers;
+	AsyncIOMsgHdr				*txHeaders;
+	struct iovec				*txVectors;
+	struct sockaddr_storage		*txAddresses;
+	int							txHead;
+	int							txCount;
+
+	// on the loop's list of sockets with sends to go out before the next wait
+	struct OpaqueAsyncIO		*nextPending;
+	bool						pending;
+} AsyncIODatagramSocket;
+#endif
 
 struct OpaqueAsyncIO
 {
+	struct OpaqueAsyncIOLoop	*loop;
+
+	uint32_t					slabIndex;
+	uint32_t					generation;			// never 0, so a handle is never 0
+	struct OpaqueAsyncIO		*nextFree;
+
 	int 						fd;
 	int							type;
 	AsyncIOEvent				callback;
@@ -89,494 +267,557 @@ struct OpaqueAsyncIO
 	bool						notifyOnRead;
 	bool						notifyOnWrite;
 
-#if ASYNC_NETIO_USE_SELECT
-	uint32_t					next_fire_time;
-
-	struct OpaqueAsyncIO		*next_timer;
-#endif
-};
+	bool						persistent;			// edge-triggered, stays registered between events
 
-AsyncIO anioInProgress = NULL;
+#if ASYNC_NETIO_USE_EPOLL
+	uint32_t					epollEvents;		// what's currently registered with the kernel
+	bool						epollRefused;		// epoll won't take it (a regular file), so it's always ready
 
-#if ASYNC_NETIO_USE_KQUEUE
-int	anioKQ = -1;
+	// on the loop's list of registrations to bring up to date before the next wait (or, once
+	//	refused, on its list of ones to report ready after it)
+	struct OpaqueAsyncIO		*epollNextDirty;
+	struct OpaqueAsyncIO		**epollPrevDirty;	// NULL when it's not on either list
 #endif
 
-#if ASYNC_NETIO_USE_SELECT
-fd_set	anioReadSet;
-fd_set	anioWriteSet;
-AsyncIO enabled_timers = NULL;
-AsyncIO aio_next_enabled_timer = NULL;
+#if ASYNC_NETIO_USE_POLL
+	short						pollEvents;			// what its entry in the loop's pollFDs asks for, 0 when it has none
+	int							pollIndex;			// where that entry is
 #endif
 
-#if ASYNC_NETIO_USE_RUN_LOOP
-CFFileDescriptorRef anioDescriptorRef = NULL;
-CFRunLoopSourceRef anioSourceRef = NULL;
-
-static void AsyncIO_PrimeRunLoop( void );
-
-#define ASYNC_NETIO_PRIME_RUN_LOOP()	\
-	do { if ( anioDescriptorRef != NULL ) { AsyncIO_PrimeRunLoop(); } } while(0)
+#if ASYNC_NETIO_USE_IO_URING
+	bool						completionReads;
+	int							uringReadOp;		// kAIOURingNoOp if there isn't one
+	int							uringWriteHead;		// queued writes, only the head is in flight
+	int							uringWriteTail;
+	const uint8_t*				completedData;
+	size_t						completedLength;
+#endif
 
-#else
+	AsyncIOTimerEntry			timer;				// on a connection, the idle timeout and deadline share it
+	uint64_t					timerDue;			// before leeway, so repeats don't drift
+	uint32_t					timerInterval;		// 0 for one shot
+	uint32_t					timerLeeway;
 
-#define ASYNC_NETIO_PRIME_RUN_LOOP()
+	// connections -- activity only stamps the time, and the timer entry sorts it out when it
+	//	fires, rather than being moved on every read
+	uint64_t					lastActivity;
+	uint32_t					idleTimeout;		// 0 for none
+	uint64_t					deadline;			// 0 for none
 
+	AsyncIOStream				*stream;			// NULL until AsyncIO_Read/AsyncIO_Write
+#if TARGET_OS_UNIXLIKE
+	AsyncIOSendFile				*sendFile;			// one at a time
 #endif
+	bool						writeRequested;		// the callback wants kAIO_READY_FOR_WRITE once those are done
 
+	int							acceptBudget;		// listeners -- 0 for kAIO_NEW_CONNECTION, else how many we accept per wakeup
 
-int	AsyncIO_Release( AsyncIO	anio, bool closeDescriptor)
-{
-	int result = -1;
-	
-	if ( anio == NULL )
-	{
-		dlog( kDebugLevelError, "AsyncIO_Release: NULL aio?\n" );
-	}
+	// monitors -- a process is reaped before its callback, and the status kept for AsyncIO_GetExitStatus()
+	int							monitored;			// the pid or signal being watched
+	bool						reaped;
+	int							exitStatus;
 
-	require( anio != NULL, exit );
+#if !ASYNC_NETIO_USE_SELECT
+	AsyncIODatagramSocket		*datagram;
+#endif
+};
 
-	if ( anio->type == kAIO_TYPE_TIMER )
-	{
-//		dlog( kDebugLevelMax, "releasing asyncio timer: %p\n", anio );
-	
-		AsyncIO_DisableTimer( anio );
-	}
+#if ASYNC_NETIO_USE_IO_URING
+typedef struct AsyncIOURing AsyncIOURing;
+#endif
 
 #if ASYNC_NETIO_USE_KQUEUE
-	int err;
 #ifdef EV_SET64
-	struct kevent64_s	kv;
+typedef struct kevent64_s	AsyncIOKevent;
 #else
-	struct kevent	kv;
+typedef struct kevent		AsyncIOKevent;
 #endif
-	if ( anio->notifyOnRead )
-	{
-#ifdef EV_SET64
-		EV_SET64( &kv, anio->fd, EVFILT_READ, EV_DELETE, 0, 0, (uint64_t)anio, 0, 0 );
-		err = kevent64( anioKQ, &kv, 1, NULL, 0, 0, NULL );
-#else
-		EV_SET( &kv, anio->fd, EVFILT_READ, EV_DELETE, 0, 0, anio );
-		err = kevent( anioKQ, &kv, 1, NULL, 0, NULL );
 #endif
-		if ( err != 0 ) { dlog( kDebugLevelError, "AsyncIO_Release: error removing READ filter (%d)\n", errno); }
-	}
 
-	if ( anio->notifyOnWrite )
-	{
-#ifdef EV_SET64
-		EV_SET64( &kv, anio->fd, EVFILT_WRITE, EV_DELETE, 0, 0, (uint64_t)anio, 0, 0 );
-		err = kevent64( anioKQ, &kv, 1, NULL, 0, 0, NULL );
-#else
-		EV_SET( &kv, anio->fd, EVFILT_WRITE, EV_DELETE, 0, 0, anio );
-		err = kevent( anioKQ, &kv, 1, NULL, 0, NULL );
-#endif
-		if ( err != 0 ) { dlog( kDebugLevelError, "AsyncIO_Release: error removing WRITE filter (%d)\n", errno); }
-	}
-#endif
+#if ASYNC_NETIO_USE_POLL
+// one ready entry, copied out of pollFDs by handle (the array can be rearranged by the callbacks)
+typedef struct
+{
+	uintptr_t					handle;
+	short						revents;
+} AsyncIOPollEvent;
 
-#if ASYNC_NETIO_USE_SELECT
-	FD_CLR( anio->fd, &anioReadSet );
-	FD_CLR( anio->fd, &anioWriteSet );
+#define kAsyncIOPollInitialSize		16
 #endif
 
-	if ( closeDescriptor )
-	{
-		// we close the descriptor and that will remove all events
-		ForgetFD( &anio->fd );
-	}
-	
-	// make sure any loop that's in progress doesn't muck with this item
-	if ( anioInProgress == anio )
-	{
-		anioInProgress = NULL;
-	}
-
-	ForgetMem( &anio );
-
-	result = 0;
-
-exit:
+typedef struct AsyncIOFileOp AsyncIOFileOp;			// AsyncIO_ReadFile/WriteFile
 
-	return result;
-}
+#define kAsyncIOMaxTasksPerPass		1024		// so a flood of posts doesn't starve the descriptors
+#define kAsyncIOOverloadRecheck		10			// ms -- how often a shedding loop that's gone quiet looks again
 
-AsyncIO		AsyncIO_NewConnectionListener( int fd, AsyncIOEvent eventCallback, void * userData )
+typedef struct AsyncIOTask
 {
-	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
+	struct AsyncIOTask			*next;
+	AsyncIOTaskFunction			function;
+	void*						context;
+} AsyncIOTask;
+
+#if TARGET_OS_UNIXLIKE && ( ASYNC_NETIO_USE_KQUEUE || ASYNC_NETIO_USE_EPOLL )
+// a persistent connection only hears about writability when it changes, so a file that has to
+//	carry on while the socket still has room is picked up again from a posted task
+typedef struct
+{
+	AsyncIOTask					post;				// first -- it goes when the task does
+	AsyncIOLoop					loop;
+	uintptr_t					handle;
+} AsyncIOSendFileResume;
+#endif
 
-	anio = calloc( 1, sizeof( struct OpaqueAsyncIO ) );
-	require( anio != NULL, exit );
+typedef struct OpaqueAsyncIOEventContext
+{
+	struct OpaqueAsyncIOLoop	*loop;
 
-	anio->fd = fd;
-	anio->type = kAIO_TYPE_LISTENER;
-	anio->callback = eventCallback;
-	anio->userdata = userData;
+	int num;
+#if ASYNC_NETIO_USE_SELECT
+	int maxFd;
+	fd_set	readfds;
+	fd_set	writefds;
+#endif
 
-	// make sure socket is in non-blocking mode
-	int flags, err;
-	flags = fcntl( fd, F_GETFL, 0 );
-	require( flags != -1, exit );
+//#define kMaxAsyncIOEvents		1
+#define kMaxAsyncIOEvents		16
+#define kMaxAsyncIOChanges		64
 
-	flags |= O_NONBLOCK;
-	err = fcntl( fd, F_SETFL, flags );
-	require( err == 0, exit );
+// how many events AsyncIOLoop_Run() asks the kernel for at once (see AsyncIOLoop_SetBatchSize())
+#define kAsyncIODefaultBatchSize	64
+#define kAsyncIOMinBatchSize		4
 
-	// add it to our kqueue
 #if ASYNC_NETIO_USE_KQUEUE
 
 #ifdef EV_SET64
-
-	struct kevent64_s	kv;
-	EV_SET64( &kv, fd, EVFILT_READ, EV_ADD, 0, 0, (uint64_t)anio, 0, 0 );
-	err = kevent64( anioKQ, &kv, 1, NULL, 0, 0, NULL );
-
+	struct kevent64_s	kv[ kMaxAsyncIOEvents ];
 #else
-
-	struct kevent	kv;
-	EV_SET( &kv, fd, EVFILT_READ, EV_ADD, 0, 0, anio );
-	err = kevent( anioKQ, &kv, 1, NULL, 0, NULL );
-
-#endif
-
-	require( err == 0, exit );
+	struct kevent		kv[ kMaxAsyncIOEvents ];
 #endif
-#if ASYNC_NETIO_USE_SELECT
-	lwip_socket_set_userdata( fd, anio );
-	FD_SET( fd, &anioReadSet );
 #endif
 
-	ASYNC_NETIO_PRIME_RUN_LOOP();
-	result = anio;
-	anio = NULL;
-
-exit:
+#if ASYNC_NETIO_USE_EPOLL
+	struct epoll_event	ev[ kMaxAsyncIOEvents ];
+#endif
 
-	ForgetMem( &anio );
+#if ASYNC_NETIO_USE_POLL
+	AsyncIOPollEvent	pv[ kMaxAsyncIOEvents ];
+#endif
 
-	return result;
-}
+} OpaqueAsyncIOEventContext;
 
-AsyncIO		AsyncIO_NewTimer( AsyncIOEvent eventCallback, void * userData )
+// one event loop -- each loop is run by one thread at a time, and
+//	every AsyncIO belongs to the loop that was current when it was created
+struct OpaqueAsyncIOLoop
 {
-	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
-
-	anio = calloc( 1, sizeof( struct OpaqueAsyncIO ) );
-	require( anio != NULL, exit );
+	AsyncIO						inProgress;
 
-	anio->fd = -1;
-	anio->type = kAIO_TYPE_TIMER;
-	anio->callback = eventCallback;
-	anio->userdata = userData;
+#if ASYNC_NETIO_USE_KQUEUE
+	int							kq;
 
-	result = anio;
-	anio = NULL;
+	// registration changes wait here, and go to the kernel along with the next kevent() wait
+	AsyncIOKevent				changes[ kMaxAsyncIOChanges ];
+	int							numChanges;
+#endif
 
-exit:
+#if ASYNC_NETIO_USE_EPOLL
+	int							ep;
+	AsyncIO						epollDirty;
+	AsyncIO						epollReady;			// refused ones that are armed, delivered after every wait
+#endif
 
-	ForgetMem( &anio );
+#if ASYNC_NETIO_USE_POLL
+	// dense, so poll() and the scan afterwards only cover what's registered -- removing one
+	//	moves the last entry into its place
+	struct pollfd				*pollFDs;
+	AsyncIO						*pollOwners;		// parallel to pollFDs
+	int							numPollFDs;
+	int							maxPollFDs;
+	int							pollNext;			// where the scan picks up when the last batch filled
+#endif
 
-	return result;
-}
+#if ASYNC_NETIO_USE_IO_URING
+	AsyncIOURing				*uring;
+#endif
 
 #if ASYNC_NETIO_USE_SELECT
-static void	AsyncIO_GetNextTimerFireTime( struct timeval *tv, AsyncIO *out_next_timer )
-{
-	uint32_t next_fire_time = 0xFFFFFFFF;
-	uint32_t now = MillisecondCounter();
-	AsyncIO next_timer = NULL;
-	AsyncIO tio = enabled_timers;
-	while ( tio != NULL )
-	{
-		if ( tio->next_fire_time < next_fire_time )
-		{
-			next_timer = tio;
-			next_fire_time = tio->next_fire_time;
-		}
-		
-		tio = tio->next_timer;
-	}
-	
-	if ( next_timer != NULL )
-	{
-		// NOTE: it's possible that a timer's 'next fire time' has already passed, and remaining will be < now
-		//		deal with that case here
-		if ( now > next_fire_time )
-		{
-			tv->tv_sec = 0;
-			tv->tv_usec = 0;
-		}
-		else
-		{
-			uint32_t remaining = next_fire_time - now;
-			tv->tv_sec = remaining / 1000;
-			tv->tv_usec = ( remaining % 1000 ) * 1000;
-		}
+	fd_set						readSet;
+	fd_set						writeSet;
+#endif
 
-		*out_next_timer = next_timer;
-	}
-}
+	AsyncIOTimerWheel			timers;
+
+#if ASYNC_NETIO_USE_RUN_LOOP
+	// when the run loop is driving us, nobody waits on the kqueue with the wheel's
+	//	timeout, so we keep one kernel timer armed for the next deadline instead
+	uint64_t					kernelTimerDeadline;
 #endif
 
-int				AsyncIO_EnableTimer( AsyncIO timer, uint32_t milliseconds )
-{
-	int result = -1;
+	OpaqueAsyncIOEventContext	events;
 
-	require( timer != NULL, exit );
+	struct OpaqueAsyncIO		**slabs;			// kAsyncIOSlabChunkSize each
+	uint32_t					numSlabs;
+	struct OpaqueAsyncIO		*freeObjects;
 
+#if !ASYNC_NETIO_USE_SELECT
+	// AsyncIOLoop_Run() drains events in batches -- the entries hold handles, so anything
+	//	released by an earlier callback in the batch just gets skipped
 #if ASYNC_NETIO_USE_KQUEUE
-	int err;
-
-#ifdef EV_SET64
-	struct kevent64_s	kv;
-	EV_SET64( &kv, (uint64_t)timer, EVFILT_TIMER, EV_ADD | EV_ENABLE | EV_ONESHOT, 0, milliseconds, (uint64_t)timer, 0, 0 );
-	err = kevent64( anioKQ, &kv, 1, NULL, 0, 0, NULL );
+	AsyncIOKevent				*batch;
+#elif ASYNC_NETIO_USE_POLL
+	AsyncIOPollEvent			*batch;
 #else
-	struct kevent	kv;
-	EV_SET( &kv, timer, EVFILT_TIMER, EV_ADD | EV_ENABLE | EV_ONESHOT, 0, milliseconds, timer );
-	err = kevent( anioKQ, &kv, 1, NULL, 0, NULL );
+	struct epoll_event			*batch;
 #endif
-	require_action_quiet( err == 0, exit, dlog( kDebugLevelError, "AsyncIO_EnableTimer( %p, %u): kevent failure (errno = %d)\n", timer, (unsigned int)milliseconds, errno ) );
+	int							dispatching;		// the batch buffer can't move while this is set
 
-	ASYNC_NETIO_PRIME_RUN_LOOP();
+	int							batchSize;			// what we ask for right now
+	int							batchMax;
+	bool						batchAdaptive;
 #endif
 
-#if ASYNC_NETIO_USE_SELECT
-	timer->next_fire_time = MillisecondCounter() + milliseconds;
-	
-	timer->next_timer = enabled_timers;
-	enabled_timers = timer;
+	// other threads poke this to get the loop's attention
+	AsyncIO						wakeup;
+	int							wakeupWriteFD;
+	int							stopRequested;
+
+#if !ASYNC_NETIO_USE_SELECT
+	// AsyncIOLoop_Post() -- producers swap themselves in at the tail, only the loop takes from the
+	//	head, and the doorbell means a burst of posts only pokes the wakeup once
+	AsyncIOTask					*postTail;
+	AsyncIOTask					*postHead;
+	AsyncIOTask					postStub;
+	int							postDoorbell;
+
+	int							offloadsPending;	// AsyncIO_Offload() work (and file I/O) that hasn't come back yet
 #endif
 
-	result = 0;
+	// AsyncIOLoop_EnableStats() -- NULL when it's off, so all it costs otherwise is the check
+	AsyncIOStats				*stats;
+	uint64_t					passMark;			// when the loop last went into, or came out of, the wait
 
-exit:
+	// AsyncIOLoop_SetOverloadPolicy() -- while shedding, the listeners aren't watched
+	bool						overloadEnabled;
+	bool						shedding;
+	uint32_t					overloadLagHigh;
+	uint32_t					overloadLagLow;
+	uint32_t					overloadOutstandingHigh;
+	uint32_t					overloadOutstandingLow;
+	uint64_t					overloadLag;		// smoothed, in microseconds
+	uint32_t					numConnections;
 
-	return result;
-}
+	uint64_t					now;				// as of the last wakeup -- what activity gets stamped with
 
-int		AsyncIO_DisableTimer( AsyncIO timer )
-{
-	int result = -1;
+#if !ASYNC_NETIO_USE_SELECT
+	AsyncIO						datagramsPending;	// datagram sockets with sends queued
+#endif
+};
 
-#if ASYNC_NETIO_USE_KQUEUE
-	int err;
-#ifdef EV_SET64
-	struct kevent64_s	kv;
-	EV_SET64( &kv, (uint64_t)timer, EVFILT_TIMER, EV_DELETE, 0, 0, (uint64_t)timer, 0, 0 );
-	err = kevent64( anioKQ, &kv, 1, NULL, 0, 0, NULL );
+#if TARGET_OS_UNIXLIKE
+	#define ASYNC_NETIO_THREAD_LOCAL	__thread
 #else
-	struct kevent	kv;
-	EV_SET( &kv, timer, EVFILT_TIMER, EV_DELETE, 0, 0, timer );
-	err = kevent( anioKQ, &kv, 1, NULL, 0, NULL );
+	#define ASYNC_NETIO_THREAD_LOCAL
 #endif
-	require( ( err == 0 ) || ( errno == ENOENT ), exit );
 
-	ASYNC_NETIO_PRIME_RUN_LOOP();
+AsyncIOLoop		anioDefaultLoop = NULL;
+static ASYNC_NETIO_THREAD_LOCAL AsyncIOLoop		anioCurrentLoop = NULL;
+
+// the loop new AsyncIOs are bound to
+#define AsyncIO_CurrentLoop()		( ( anioCurrentLoop != NULL ) ? anioCurrentLoop : anioDefaultLoop )
+
+static void	AsyncIO_TimerFired( AsyncIOLoop loop, AsyncIOTimerEntry *entry );
+static void	AsyncIO_CancelTimerEntry( AsyncIOLoop loop, AsyncIOTimerEntry *entry );
+static void	AsyncIO_ForgetStream( AsyncIO anio );
+#if !ASYNC_NETIO_USE_SELECT
+static void	AsyncIO_SendQueuedDatagrams( AsyncIO anio );
+static void	AsyncIO_ForgetDatagram( AsyncIO anio );
 #endif
 
-#if ASYNC_NETIO_USE_SELECT
+static inline uint64_t	AsyncIO_Microseconds( void )
+{
+	return NanosecondCounter() / 1000;
+}
+
+// bucket 0 is zero, bucket n is [ 2^(n-1), 2^n ), and the last one takes everything bigger
+static void	AsyncIO_StatsRecord( AsyncIOHistogram *histogram, uint64_t value )
+{
+	int bucket = 0;
 
-	if ( timer == aio_next_enabled_timer )
+	if ( value > 0 )
 	{
-		aio_next_enabled_timer = NULL;
+		bucket = Minimum( 64 - __builtin_clzll( value ), kAsyncIOStatsBuckets - 1 );
 	}
 
-	AsyncIO tio = enabled_timers;
-	require( tio != NULL, exit );
-	
-	if ( tio == timer )
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->total += value;
+	if ( value > histogram->max )
+	{
+		histogram->max = value;
+	}
+}
+
+// every callback goes through here, so it can be timed when stats are on (the callback
+//	can release anio, so the loop is picked up first)
+static inline void	AsyncIO_CallBack( AsyncIO anio, int eventID, int fd )
+{
+	AsyncIOLoop loop = anio->loop;
+
+	anio->lastActivity = loop->now;
+
+	if ( loop->stats == NULL )
 	{
-		enabled_timers = tio->next_timer;
+		(*(anio->callback))( eventID, anio, fd, anio->userdata );
 	}
 	else
 	{
-		while ( true )
+		uint64_t start = AsyncIO_Microseconds(), elapsed;
+
+		(*(anio->callback))( eventID, anio, fd, anio->userdata );
+
+		// the callback might have turned them off
+		if ( loop->stats != NULL )
 		{
-			if ( tio->next_timer == timer )
+			elapsed = AsyncIO_Microseconds() - start;
+			loop->stats->usInCallbacks += elapsed;
+			if ( ( eventID >= 0 ) && ( eventID < kAsyncIOStatsEventTypes ) )
 			{
-				tio->next_timer = timer->next_timer;
-				break;
+				AsyncIO_StatsRecord( &loop->stats->callbackLatency[eventID], elapsed );
 			}
-			
-			tio = tio->next_timer;
-			require( tio != NULL, exit );
 		}
 	}
-	
-	// housekeeping (not really necessary)
-	timer->next_timer = NULL;
-#endif
-
-	result = 0;
-
-exit:
+}
 
-	return result;
+static inline uintptr_t	AsyncIO_Handle( AsyncIO anio )
+{
+	return ( (uintptr_t)anio->generation << kAsyncIOHandleIndexBits ) | anio->slabIndex;
 }
 
-#if ASYNC_NETIO_USE_KQUEUE
-AsyncIO		AsyncIO_NewProcessMonitor( pid_t pid, AsyncIOEvent eventCallback, void * userData )
+// NULL if what it referred to has been released
+static AsyncIO	AsyncIO_FromHandle( AsyncIOLoop loop, uintptr_t handle )
 {
-	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
+	uint32_t index = (uint32_t)( handle & kAsyncIOHandleIndexMask );
+	uint32_t generation = (uint32_t)( handle >> kAsyncIOHandleIndexBits );
+	AsyncIO anio;
 
-	anio = calloc( 1, sizeof( struct OpaqueAsyncIO ) );
-	require( anio != NULL, exit );
+	if ( ( index / kAsyncIOSlabChunkSize ) >= loop->numSlabs )
+		return NULL;
 
-	anio->fd = -1;
-	anio->type = kAIO_TYPE_PROC;
-	anio->callback = eventCallback;
-	anio->userdata = userData;
+	anio = &loop->slabs[index / kAsyncIOSlabChunkSize][index % kAsyncIOSlabChunkSize];
 
-	int err;
+	return ( anio->generation == generation ) ? anio : NULL;
+}
 
-#ifdef EV_SET64
-	struct kevent64_s	kv;
-	EV_SET64( &kv, (uint64_t)pid, EVFILT_PROC, EV_ADD | EV_ENABLE | EV_ONESHOT, NOTE_EXIT, 0, (uint64_t)anio, 0, 0 );
-	err = kevent64( anioKQ, &kv, 1, NULL, 0, 0, NULL );
-#else
-	struct kevent	kv;
-	EV_SET( &kv, pid, EVFILT_PROC, EV_ADD | EV_ENABLE | EV_ONESHOT, NOTE_EXIT, 0, anio );
-	err = kevent( anioKQ, &kv, 1, NULL, 0, NULL );
+#if ASYNC_NETIO_USE_IO_URING
+static void AsyncIO_URingRelease( AsyncIO anio );
+static void AsyncIO_URingSubmit( AsyncIOLoop loop );
+static void AsyncIO_URingReapCompletions( AsyncIOLoop loop );
+static void AsyncIO_URingCompleteFileOp( AsyncIOLoop loop, AsyncIOFileOp *op, int res );
 #endif
-	if ( err != 0 )
-	{
-		dlog( kDebugLevelError, "kevent error %d\n", errno );
-	}
-	require( err == 0, exit );
 
-	ASYNC_NETIO_PRIME_RUN_LOOP();
-	result = anio;
-	anio = NULL;
+#if ASYNC_NETIO_USE_RUN_LOOP
+CFFileDescriptorRef anioDescriptorRef = NULL;
+CFRunLoopSourceRef anioSourceRef = NULL;
 
-exit:
+static void AsyncIO_PrimeRunLoop( void );
 
-	ForgetMem( &anio );
+#define ASYNC_NETIO_PRIME_RUN_LOOP()	\
+	do { if ( anioDescriptorRef != NULL ) { AsyncIO_PrimeRunLoop(); } } while(0)
 
-	return result;
-}
+#else
 
-AsyncIO		AsyncIO_NewSignalMonitor( int sig_id, AsyncIOEvent eventCallback, void * userData )
+#define ASYNC_NETIO_PRIME_RUN_LOOP()
+
+#endif
+
+#if ASYNC_NETIO_USE_EPOLL
+
+// epoll only allows one registration per descriptor, so the read and write interest
+//	are combined, and we only call into the kernel when the combination changes
+static uint32_t AsyncIO_EpollInterest( AsyncIO anio )
 {
-	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
+	uint32_t events = 0;
 
-	anio = calloc( 1, sizeof( struct OpaqueAsyncIO ) );
-	require( anio != NULL, exit );
+	if ( anio->notifyOnRead )	{ events |= EPOLLIN | EPOLLRDHUP; }
+	if ( anio->notifyOnWrite )	{ events |= EPOLLOUT; }
+	if ( anio->persistent && ( events != 0 ) )	{ events |= EPOLLET; }
 
-	anio->fd = -1;
-	anio->type = kAIO_TYPE_SIGNAL;
-	anio->callback = eventCallback;
-	anio->userdata = userData;
+	return events;
+}
 
-	int err;
+static int AsyncIO_UpdateEpollRegistration( AsyncIO anio )
+{
+	int result = -1;
+	AsyncIOLoop loop = anio->loop;
+	struct epoll_event ev;
+	uint32_t events = AsyncIO_EpollInterest( anio );
+	int op, err;
 
-	// must set signal to be ignored
-	signal( sig_id, SIG_IGN );
+	require( loop->ep >= 0, exit );
 
-#ifdef EV_SET64
-	struct kevent64_s	kv;
-	EV_SET64( &kv, sig_id, EVFILT_SIGNAL, EV_ADD | EV_ENABLE | EV_ONESHOT, 0, 0, (uint64_t)anio, 0, 0 );
-	err = kevent64( anioKQ, &kv, 1, NULL, 0, 0, NULL );
-#else
-	struct kevent	kv;
-	EV_SET( &kv, sig_id, EVFILT_SIGNAL, EV_ADD | EV_ENABLE | EV_ONESHOT, 0, 0, anio );
-	err = kevent( anioKQ, &kv, 1, NULL, 0, NULL );
-#endif
-	if ( err != 0 )
+	// nothing to tell the kernel
+	require_action_quiet( events != anio->epollEvents, exit, result = 0 );
+
+	if ( events == 0 )
 	{
-		dlog( kDebugLevelError, "kevent error %d\n", errno );
+		op = EPOLL_CTL_DEL;
+	}
+	else if ( anio->epollEvents == 0 )
+	{
+		op = EPOLL_CTL_ADD;
+	}
+	else
+	{
+		op = EPOLL_CTL_MOD;
 	}
-	require( err == 0, exit );
 
-	ASYNC_NETIO_PRIME_RUN_LOOP();
-	result = anio;
-	anio = NULL;
+	memset( &ev, 0, sizeof( ev ) );
+	ev.events = events;
+	ev.data.u64 = AsyncIO_Handle( anio );
+	err = epoll_ctl( loop->ep, op, anio->fd, &ev );
+	if ( err != 0 ) { dlog( kDebugLevelError, "AsyncIO: epoll_ctl( %d, %d, 0x%08X ): error = %d\n", anio->fd, op, (unsigned int)events, errno ); }
+	require_quiet( err == 0, exit );
 
-exit:
+	anio->epollEvents = events;
+	result = 0;
 
-	ForgetMem( &anio );
+exit:
 
 	return result;
 }
-#endif
 
+// interest changes are only handed to the kernel just before the next epoll_wait(), so arming
+//	read and write together, or re-arming from inside a callback, costs at most one epoll_ctl()
+static void AsyncIO_LinkEpoll( AsyncIO anio, AsyncIO *list )
+{
+	if ( anio->epollPrevDirty == NULL )
+	{
+		anio->epollNextDirty = *list;
+		if ( anio->epollNextDirty != NULL )
+		{
+			anio->epollNextDirty->epollPrevDirty = &anio->epollNextDirty;
+		}
+		anio->epollPrevDirty = list;
+		*list = anio;
+	}
+}
+
+static void AsyncIO_MarkEpollDirty( AsyncIO anio )
+{
+	AsyncIO_LinkEpoll( anio, &anio->loop->epollDirty );
+}
 
-AsyncIO		AsyncIO_NewConnection( int fd, AsyncIOEvent eventCallback, void * userData )
+static void AsyncIO_UnmarkEpollDirty( AsyncIO anio )
 {
-	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
+	if ( anio->epollPrevDirty != NULL )
+	{
+		*anio->epollPrevDirty = anio->epollNextDirty;
+		if ( anio->epollNextDirty != NULL )
+		{
+			anio->epollNextDirty->epollPrevDirty = anio->epollPrevDirty;
+		}
+		anio->epollNextDirty = NULL;
+		anio->epollPrevDirty = NULL;
+	}
+}
 
-	anio = calloc( 1, sizeof( struct OpaqueAsyncIO ) );
-	require( anio != NULL, exit );
+static void AsyncIO_FlushEpollChanges( AsyncIOLoop loop )
+{
+	AsyncIO anio;
+	int err;
 
-	anio->fd = fd;
-	anio->type = kAIO_TYPE_CONNECTION;
-	anio->callback = eventCallback;
-	anio->userdata = userData;
+	while ( ( anio = loop->epollDirty ) != NULL )
+	{
+		AsyncIO_UnmarkEpollDirty( anio );
 
-	// make sure socket is in non-blocking mode
-	int flags, err;
-	flags = fcntl( fd, F_GETFL, 0 );
-	require( flags != -1, exit );
+		err = anio->epollRefused ? 0 : AsyncIO_UpdateEpollRegistration( anio );
+		if ( ( err != 0 ) && ( errno == EPERM ) && ( anio->epollEvents == 0 ) )
+		{
+			// regular files (and directories) never block, and epoll says so by not taking them --
+			//	so they're simply reported ready after every wait for as long as they're armed
+			anio->epollRefused = true;
+			err = 0;
+		}
 
-	flags |= O_NONBLOCK;
-//#if !TARGET_OS_FREERTOS
-//	flags |= O_ASYNC;
-//#endif
-	err = fcntl( fd, F_SETFL, flags );
-	if ( err != 0 ) { dlog( kDebugLevelError, "AsyncIO: fcntl( %d, F_SETFL, 0x%08X): error = %d\r\n", fd, flags, errno ); }
-	if ( ( err != 0 ) && ( errno == ENOTTY ) ) { err = 0; }
-	require( err == 0, exit );
+		if ( err != 0 )
+		{
+			// the kernel didn't take it, so don't claim we're waiting on something we're not
+			anio->notifyOnRead = ( ( anio->epollEvents & EPOLLIN ) != 0 );
+			anio->notifyOnWrite = ( ( anio->epollEvents & EPOLLOUT ) != 0 );
+		}
+		else if ( anio->epollRefused && ( AsyncIO_EpollInterest( anio ) != 0 ) )
+		{
+			AsyncIO_LinkEpoll( anio, &loop->epollReady );
+		}
+	}
+}
 
-#if ASYNC_NETIO_USE_SELECT
-	lwip_socket_set_userdata( fd, anio );
 #endif
 
-	result = anio;
-	anio = NULL;
+#if ASYNC_NETIO_USE_POLL
 
-exit:
+static short AsyncIO_PollInterest( AsyncIO anio )
+{
+	short events = 0;
 
-	ForgetMem( &anio );
+	if ( anio->notifyOnRead )	{ events |= POLLIN | POLLRDHUP; }
+	if ( anio->notifyOnWrite )	{ events |= POLLOUT; }
 
-	return result;
+	return events;
 }
 
-int				AsyncIO_NotifyOnReadability( AsyncIO anio )
+// the registration is just our array entry, so it's brought up to date right away -- adding
+//	one appends it (growing the arrays if need be), and dropping one fills its hole from the end
+static int AsyncIO_UpdatePollRegistration( AsyncIO anio )
 {
 	int result = -1;
+	AsyncIOLoop loop = anio->loop;
+	short events = AsyncIO_PollInterest( anio );
+	int last;
 
-	int err;
-#if ASYNC_NETIO_USE_KQUEUE
-	require( anioKQ >= 0, exit );
+	require_action_quiet( events != anio->pollEvents, exit, result = 0 );
 
-#ifdef EV_SET64
+	if ( events == 0 )
+	{
+		last = --loop->numPollFDs;
+		if ( anio->pollIndex != last )
+		{
+			loop->pollFDs[ anio->pollIndex ] = loop->pollFDs[ last ];
+			loop->pollOwners[ anio->pollIndex ] = loop->pollOwners[ last ];
+			loop->pollOwners[ anio->pollIndex ]->pollIndex = anio->pollIndex;
+		}
+	}
+	else
+	{
+		if ( anio->pollEvents == 0 )
+		{
+			if ( loop->numPollFDs == loop->maxPollFDs )
+			{
+				int newMax = ( loop->maxPollFDs > 0 ) ? ( loop->maxPollFDs * 2 ) : kAsyncIOPollInitialSize;
+				struct pollfd *fds;
+				AsyncIO *owners;
 
-	struct kevent64_s	kv;
-	EV_SET64( &kv, anio->fd, EVFILT_READ, EV_ADD | EV_ONESHOT, 0, 0, (uint64_t)anio, 0, 0 );
-	err = kevent64( anioKQ, &kv, 1, NULL, 0, 0, NULL );
+				fds = realloc( loop->pollFDs, newMax * sizeof( struct pollfd ) );
+				require( fds != NULL, exit );
+				loop->pollFDs = fds;
 
-#else
+				owners = realloc( loop->pollOwners, newMax * sizeof( AsyncIO ) );
+				require( owners != NULL, exit );
+				loop->pollOwners = owners;
 
-	struct kevent	kv;
-	EV_SET( &kv, anio->fd, EVFILT_READ, EV_ADD | EV_ONESHOT, 0, 0, anio );
-	err = kevent( anioKQ, &kv, 1, NULL, 0, NULL );
+				loop->maxPollFDs = newMax;
+			}
 
-#endif
+			anio->pollIndex = loop->numPollFDs++;
+			loop->pollFDs[ anio->pollIndex ].fd = anio->fd;
+			loop->pollFDs[ anio->pollIndex ].revents = 0;
+			loop->pollOwners[ anio->pollIndex ] = anio;
+		}
 
-	if ( err != 0 )
-	{
-		dlog( kDebugLevelError, "kevent: error %d\n", errno );
+		loop->pollFDs[ anio->pollIndex ].events = events;
 	}
-	require_quiet( err == 0, exit );
-#endif
-#if ASYNC_NETIO_USE_SELECT
-	err = lwip_socket_set_userdata( anio->fd, anio );
-	require( err == 0, exit );
-	FD_SET( anio->fd, &anioReadSet );
-#endif
 
-	ASYNC_NETIO_PRIME_RUN_LOOP();
-	anio->notifyOnRead = true;
+	anio->pollEvents = events;
 	result = 0;
 
 exit:
@@ -584,125 +825,186 @@ exit:
 	return result;
 }
 
-int				AsyncIO_NotifyOnWritability( AsyncIO anio )
-{
-	int result = -1;
+#endif
 
-	int err;
 #if ASYNC_NETIO_USE_KQUEUE
 
-	require( anioKQ >= 0, exit );
+// something we queued didn't take -- only adds get queued (Release() purges its own entries),
+//	so the AsyncIO should still be around, and forgetting the interest lets the next request re-queue it
+static void AsyncIO_ChangeFailed( AsyncIOLoop loop, AsyncIOKevent *kv )
+{
+	AsyncIO anio = AsyncIO_FromHandle( loop, (uintptr_t)kv->udata );
 
-#ifdef EV_SET64
+	dlog( kDebugLevelError, "AsyncIO: kevent change for %d (filter %d) failed: %d\n", (int)kv->ident, (int)kv->filter, (int)kv->data );
+	require_quiet( anio != NULL, exit );
 
-	struct kevent64_s	kv;
-	EV_SET64( &kv, anio->fd, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, (uint64_t)anio, 0, 0 );
-	err = kevent64( anioKQ, &kv, 1, NULL, 0, 0, NULL );
+	if ( kv->filter == EVFILT_READ )
+		anio->notifyOnRead = false;
+	else if ( kv->filter == EVFILT_WRITE )
+		anio->notifyOnWrite = false;
 
-#else
+exit:
+	;
+}
 
-	struct kevent	kv;
-	EV_SET( &kv, anio->fd, EVFILT_WRITE, EV_ADD | EV_ONESHOT, 0, 0, anio );
-	err = kevent( anioKQ, &kv, 1, NULL, 0, NULL );
+// hands the queued changes to the kernel now, rather than with the next wait
+static int AsyncIO_FlushChanges( AsyncIOLoop loop )
+{
+	AsyncIOKevent receipts[ kMaxAsyncIOChanges ];
+	struct timespec zero = { 0, 0 };
+	int num, i;
 
+	if ( loop->numChanges == 0 )
+		return 0;
+
+#ifdef EV_RECEIPT
+	// a receipt for every change means errors don't stop the rest, and no events get pulled off the queue
+	for ( i = 0; i < loop->numChanges; i++ )
+	{
+		loop->changes[i].flags |= EV_RECEIPT;
+	}
+#ifdef EV_SET64
+	num = kevent64( loop->kq, loop->changes, loop->numChanges, receipts, loop->numChanges, 0, &zero );
+#else
+	num = kevent( loop->kq, loop->changes, loop->numChanges, receipts, loop->numChanges, &zero );
 #endif
-	require( err == 0, exit );
+#else
+#ifdef EV_SET64
+	num = kevent64( loop->kq, loop->changes, loop->numChanges, NULL, 0, 0, &zero );
+#else
+	num = kevent( loop->kq, loop->changes, loop->numChanges, NULL, 0, &zero );
 #endif
-#if ASYNC_NETIO_USE_SELECT
-	err = lwip_socket_set_userdata( anio->fd, anio );
-	require( err == 0, exit );
-	FD_SET( anio->fd, &anioWriteSet );
 #endif
+	if ( num < 0 ) { dlog( kDebugLevelError, "AsyncIO: kevent changelist error %d\n", errno ); }
 
-	ASYNC_NETIO_PRIME_RUN_LOOP();
-	anio->notifyOnWrite = true;
-	result = 0;
+	for ( i = 0; i < num; i++ )
+	{
+		if ( ( receipts[i].flags & EV_ERROR ) && ( receipts[i].data != 0 ) )
+		{
+			AsyncIO_ChangeFailed( loop, &receipts[i] );
+		}
+	}
 
-exit:
+	loop->numChanges = 0;
 
-	return result;
+	return ( num < 0 ) ? -1 : 0;
 }
 
-#if ASYNC_NETIO_USE_RUN_LOOP
-
-static void AsyncIO_PrimeRunLoop( void )
+static void AsyncIO_QueueChange( AsyncIO anio, int filter, int flags )
 {
-	CFFileDescriptorEnableCallBacks( anioDescriptorRef, kCFFileDescriptorReadCallBack );
-}
+	AsyncIOLoop loop = anio->loop;
 
-static void AsyncIO_CFFileDescriptorCallBack( CFFileDescriptorRef f, CFOptionFlags callBackTypes, void *info )
-{
-	//dlog( kDebugLevelChatty, "AsyncIO_CFFileDescriptorCallBack: 0x%08lX\n", callBackTypes );
-	require( f == anioDescriptorRef, exit );
-	require( info == NULL, exit );
-	require( callBackTypes == kCFFileDescriptorReadCallBack, exit );
+	if ( loop->numChanges == kMaxAsyncIOChanges )
+	{
+		AsyncIO_FlushChanges( loop );
+	}
 
-	int err;
-	err = AsyncIO_Run( 0 );
-	require( err == 0, exit );
-	
-	// re-enable read notification
-	CFFileDescriptorEnableCallBacks( anioDescriptorRef, kCFFileDescriptorReadCallBack );
-	
-exit:
-	;
-}
+#ifdef EV_SET64
+	EV_SET64( &loop->changes[loop->numChanges], anio->fd, filter, flags, 0, 0, (uint64_t)AsyncIO_Handle( anio ), 0, 0 );
+#else
+	EV_SET( &loop->changes[loop->numChanges], anio->fd, filter, flags, 0, 0, (void*)AsyncIO_Handle( anio ) );
 #endif
+	loop->numChanges++;
+}
 
+// drops anything still queued for this one, it's about to go away
+static void AsyncIO_PurgeChanges( AsyncIO anio )
+{
+	AsyncIOLoop loop = anio->loop;
+	uintptr_t handle = AsyncIO_Handle( anio );
+	int i, kept = 0;
 
+	for ( i = 0; i < loop->numChanges; i++ )
+	{
+		if ( (uintptr_t)loop->changes[i].udata != handle )
+		{
+			loop->changes[kept++] = loop->changes[i];
+		}
+	}
 
-int AsyncIO_Initialize( int flags )
-{
-	int result = -1;
+	loop->numChanges = kept;
+}
 
-	require( 1, exit );
+// waits for events, handing the kernel whatever changes were queued up on the way in
+static int AsyncIO_KeventWait( AsyncIOLoop loop, AsyncIOKevent *events, int nevents, const struct timespec *timeout )
+{
+	int num;
 
-#if __APPLE__
-	int enableRunLoop = 0;
-	
-	if ( ( flags & kAsyncIOFlags_UseRunLoop ) != 0 )
-		enableRunLoop = 1;
+#ifdef EV_SET64
+	num = kevent64( loop->kq, loop->changes, loop->numChanges, events, nevents, 0, timeout );
 #else
-	(void)flags;
+	num = kevent( loop->kq, loop->changes, loop->numChanges, events, nevents, timeout );
 #endif
-
-#if ASYNC_NETIO_USE_SELECT
-	FD_ZERO( &anioReadSet );
-	FD_ZERO( &anioWriteSet );
+	if ( ( num < 0 ) && ( loop->numChanges > 0 ) && ( errno != EINTR ) )
+	{
+		// a bad change with no room to report it -- adds are safe to repeat, so do them on
+		//	their own (each one gets its own error) and wait again
+		AsyncIO_FlushChanges( loop );
+#ifdef EV_SET64
+		num = kevent64( loop->kq, NULL, 0, events, nevents, 0, timeout );
+#else
+		num = kevent( loop->kq, NULL, 0, events, nevents, timeout );
 #endif
+	}
 
-#if ASYNC_NETIO_USE_KQUEUE
+	if ( num >= 0 )
+	{
+		loop->numChanges = 0;
+	}
 
-	anioKQ = kqueue();
-	require( anioKQ >= 0, exit );
+	return num;
+}
 
-#if ASYNC_NETIO_USE_RUN_LOOP
+#endif
 
-	if ( enableRunLoop )
+// loop is normally AsyncIO_CurrentLoop()
+static void	AsyncIO_FreeObject( AsyncIO anio )
+{
+	AsyncIOLoop loop = anio->loop;
+	uint32_t index = anio->slabIndex;
+	uint32_t generation = ( anio->generation + 1 ) & kAsyncIOGenerationMask;
+
+	if ( anio->type == kAIO_TYPE_CONNECTION )
 	{
-		anioDescriptorRef = CFFileDescriptorCreate( kCFAllocatorDefault,
-			anioKQ,
-			false,
-			AsyncIO_CFFileDescriptorCallBack,
-			NULL );
-		require( anioDescriptorRef != NULL, exit );
+		loop->numConnections--;
+	}
 
-		CFFileDescriptorEnableCallBacks( anioDescriptorRef, kCFFileDescriptorReadCallBack );
+	// anything still holding the old handle won't resolve any more
+	memset( anio, 0, sizeof( struct OpaqueAsyncIO ) );
+	anio->slabIndex = index;
+	anio->generation = ( generation != 0 ) ? generation : 1;
 
-		// hopefully this doesn't fail...
-		anioSourceRef = CFFileDescriptorCreateRunLoopSource( kCFAllocatorDefault, anioDescriptorRef, 0 );
-		require( anioSourceRef != NULL, exit );
+	anio->nextFree = loop->freeObjects;
+	loop->freeObjects = anio;
+}
 
-		CFRunLoopAddSource( CFRunLoopGetMain(), anioSourceRef, kCFRunLoopDefaultMode );
+#define ForgetAsyncIOObject( x )		do { if ( (*x) != NULL ) { AsyncIO_FreeObject( (*x) ); (*x) = NULL; } } while(0)
 
-		CFRelease( anioSourceRef );
-		
-	}
+static int	AsyncIO_GrowSlabs( AsyncIOLoop loop )
+{
+	int result = -1;
+	struct OpaqueAsyncIO **slabs, *slab;
+	int i;
 
-#endif
+	require( ( ( loop->numSlabs + 1 ) * kAsyncIOSlabChunkSize ) <= kAsyncIOHandleIndexMask, exit );
 
-#endif
+	slabs = realloc( loop->slabs, ( loop->numSlabs + 1 ) * sizeof( *slabs ) );
+	require( slabs != NULL, exit );
+	loop->slabs = slabs;
+
+	slab = calloc( kAsyncIOSlabChunkSize, sizeof( struct OpaqueAsyncIO ) );
+	require( slab != NULL, exit );
+
+	// backwards, so they're handed out in order
+	for ( i = kAsyncIOSlabChunkSize - 1; i >= 0; i-- )
+	{
+		slab[i].slabIndex = ( loop->numSlabs * kAsyncIOSlabChunkSize ) + i;
+		slab[i].generation = 1;
+		slab[i].nextFree = loop->freeObjects;
+		loop->freeObjects = &slab[i];
+	}
 
+	loop->slabs[loop->numSlabs++] = slab;
 	result = 0;
 
 exit:
@@ -710,750 +1012,5566 @@ exit:
 	return result;
 }
 
+static AsyncIO	AsyncIO_NewObject( AsyncIOLoop loop, int fd, int type, AsyncIOEvent eventCallback, void * userData )
+{
+	struct OpaqueAsyncIO *anio = NULL;
 
-#warning "FIX ME: thrash detection is busted"
-// not sure what's wrong, but it's detecting stuff incorrectly (not surprised -- just haven't debugged)
-#if THRASH_DETECTION
-size_t	runs = 0;
-bool	tvStartTimeValid = false;
-struct	timeval tvStart;
-struct	timeval	tvEnd;
-#endif
+	if ( loop == NULL ) { dlog( kDebugLevelError, "AsyncIO: no loop (call AsyncIO_Initialize first)\n" ); }
+	require_quiet( loop != NULL, exit );
 
-typedef struct OpaqueAsyncIOEventContext
-{
-	int num;
-#if ASYNC_NETIO_USE_SELECT
-	int maxFd;
-	fd_set	readfds;
-	fd_set	writefds;
+	if ( loop->freeObjects == NULL )
+	{
+		int err = AsyncIO_GrowSlabs( loop );
+		require_quiet( err == 0, exit );
+	}
+
+	anio = loop->freeObjects;
+	loop->freeObjects = anio->nextFree;
+	anio->nextFree = NULL;
+
+	anio->loop = loop;
+	anio->fd = fd;
+	anio->type = type;
+	anio->callback = eventCallback;
+	anio->userdata = userData;
+
+	if ( type == kAIO_TYPE_CONNECTION )
+	{
+		loop->numConnections++;
+	}
+
+exit:
+
+	return anio;
+}
+
+#if ASYNC_NETIO_USE_KQUEUE || ASYNC_NETIO_USE_EPOLL
+static void	AsyncIO_ReturnSignal( AsyncIO anio );
 #endif
 
+int	AsyncIO_Release( AsyncIO	anio, bool closeDescriptor)
+{
+	int result = -1;
+	
+	if ( anio == NULL )
+	{
+		dlog( kDebugLevelError, "AsyncIO_Release: NULL aio?\n" );
+	}
+
+	require( anio != NULL, exit );
+
+	AsyncIOLoop loop = anio->loop;
+
+	if ( anio->type == kAIO_TYPE_TIMER )
+	{
+//		dlog( kDebugLevelMax, "releasing asyncio timer: %p\n", anio );
+	
+		AsyncIO_DisableTimer( anio );
+	}
+	else if ( anio->type == kAIO_TYPE_CONNECTION )
+	{
+		AsyncIO_CancelTimerEntry( loop, &anio->timer );
+	}
+
 #if ASYNC_NETIO_USE_KQUEUE
+	int err;
+#ifdef EV_SET64
+	struct kevent64_s	kv;
+#else
+	struct kevent	kv;
+#endif
+	// anything still queued points at this one, so it can't go to the kernel
+	AsyncIO_PurgeChanges( anio );
 
-//#define kMaxAsyncIOEvents		1
-#define kMaxAsyncIOEvents		16
+	// closing the descriptor takes its filters with it, so only remove them if it's staying open
+	if ( closeDescriptor )
+	{
+		anio->notifyOnRead = false;
+		anio->notifyOnWrite = false;
+	}
 
+	// (ENOENT is fine, the add may have still been queued)
+	if ( anio->notifyOnRead )
+	{
 #ifdef EV_SET64
-	struct kevent64_s	kv[ kMaxAsyncIOEvents ];
+		EV_SET64( &kv, anio->fd, EVFILT_READ, EV_DELETE, 0, 0, (uint64_t)AsyncIO_Handle( anio ), 0, 0 );
+		err = kevent64( loop->kq, &kv, 1, NULL, 0, 0, NULL );
 #else
-	struct kevent		kv[ kMaxAsyncIOEvents ];
+		EV_SET( &kv, anio->fd, EVFILT_READ, EV_DELETE, 0, 0, (void*)AsyncIO_Handle( anio ) );
+		err = kevent( loop->kq, &kv, 1, NULL, 0, NULL );
+#endif
+		if ( ( err != 0 ) && ( errno != ENOENT ) ) { dlog( kDebugLevelError, "AsyncIO_Release: error removing READ filter (%d)\n", errno); }
+	}
+
+	if ( anio->notifyOnWrite )
+	{
+#ifdef EV_SET64
+		EV_SET64( &kv, anio->fd, EVFILT_WRITE, EV_DELETE, 0, 0, (uint64_t)AsyncIO_Handle( anio ), 0, 0 );
+		err = kevent64( loop->kq, &kv, 1, NULL, 0, 0, NULL );
+#else
+		EV_SET( &kv, anio->fd, EVFILT_WRITE, EV_DELETE, 0, 0, (void*)AsyncIO_Handle( anio ) );
+		err = kevent( loop->kq, &kv, 1, NULL, 0, NULL );
 #endif
+		if ( ( err != 0 ) && ( errno != ENOENT ) ) { dlog( kDebugLevelError, "AsyncIO_Release: error removing WRITE filter (%d)\n", errno); }
+	}
 #endif
 
-} OpaqueAsyncIOEventContext;
+#if ASYNC_NETIO_USE_EPOLL
+	// always remove it ourselves -- closing the descriptor won't if it has been dup'ed
+	anio->notifyOnRead = false;
+	anio->notifyOnWrite = false;
+	AsyncIO_UnmarkEpollDirty( anio );
+	if ( anio->epollEvents != 0 )
+	{
+		AsyncIO_UpdateEpollRegistration( anio );
+	}
+#endif
 
+#if ASYNC_NETIO_USE_POLL
+	anio->notifyOnRead = false;
+	anio->notifyOnWrite = false;
+	AsyncIO_UpdatePollRegistration( anio );
+#endif
 
-OpaqueAsyncIOEventContext gAsyncIOContext;
+#if ASYNC_NETIO_USE_SELECT
+	FD_CLR( anio->fd, &loop->readSet );
+	FD_CLR( anio->fd, &loop->writeSet );
+#endif
 
-int				AsyncIO_WaitForEvents( AsyncIOEventsContext *outEventsContext, struct timeval *timeout )
-{
-	int result = -1;
-	
-	require( outEventsContext != NULL, exit );
+#if ASYNC_NETIO_USE_IO_URING
+	AsyncIO_URingRelease( anio );
+#endif
+
+#if ASYNC_NETIO_USE_EPOLL
+	// a monitor's pidfd or signalfd is ours, whatever the caller says
+	if ( ( anio->type == kAIO_TYPE_PROC ) || ( anio->type == kAIO_TYPE_SIGNAL ) )
+	{
+		closeDescriptor = true;
+	}
+#endif
+
+#if ASYNC_NETIO_USE_KQUEUE || ASYNC_NETIO_USE_EPOLL
+	if ( anio->type == kAIO_TYPE_SIGNAL )
+	{
+		AsyncIO_ReturnSignal( anio );
+	}
+#endif
+
+	// anything still queued for output is dropped, and a file that's going out is abandoned
+	AsyncIO_ForgetStream( anio );
+#if TARGET_OS_UNIXLIKE
+	ForgetMem( &anio->sendFile );
+#endif
+#if !ASYNC_NETIO_USE_SELECT
+	AsyncIO_ForgetDatagram( anio );
+#endif
+
+	if ( closeDescriptor )
+	{
+		// we close the descriptor and that will remove all events
+		ForgetFD( &anio->fd );
+	}
 	
-	AsyncIOEventsContext ctx = &gAsyncIOContext;
-	*outEventsContext = ctx;
+	// make sure any loop that's in progress doesn't muck with this item
+	if ( loop->inProgress == anio )
+	{
+		loop->inProgress = NULL;
+	}
 
+	ForgetAsyncIOObject( &anio );
 
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+// stops (or resumes) watching a listener for new connections, without giving up its registration
+static void	AsyncIO_PauseListener( AsyncIO anio, bool pause )
+{
+#if ASYNC_NETIO_USE_KQUEUE
+	AsyncIO_QueueChange( anio, EVFILT_READ, pause ? EV_DISABLE : EV_ENABLE );
+#endif
+#if ASYNC_NETIO_USE_EPOLL
+	anio->notifyOnRead = !pause;
+	AsyncIO_MarkEpollDirty( anio );
+#endif
+#if ASYNC_NETIO_USE_POLL
+	anio->notifyOnRead = !pause;
+	AsyncIO_UpdatePollRegistration( anio );
+#endif
 #if ASYNC_NETIO_USE_SELECT
+	if ( pause )
+		FD_CLR( anio->fd, &anio->loop->readSet );
+	else
+		FD_SET( anio->fd, &anio->loop->readSet );
+#endif
+}
 
-	// take a look at <https://www.freertos.org/Pend-on-multiple-rtos-objects.html>
-	// see if it's possible to have other objects we could wait on, inside the lwip select (we might need to have it call back to us)
+AsyncIO		AsyncIO_NewConnectionListener( int fd, AsyncIOEvent eventCallback, void * userData )
+{
+	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
 
-#warning "FIX ME: select case never posts kAIO_CONNECTION_CLOSED events for read"
-	// we don't handle the EV_EOF case
+	anio = AsyncIO_NewObject( AsyncIO_CurrentLoop(), fd, kAIO_TYPE_LISTENER, eventCallback, userData );
+	require( anio != NULL, exit );
 
-	int i;
-	//struct timeval timeout;
-	struct timeval *to;
+	// make sure socket is in non-blocking mode
+	int flags, err;
+	flags = fcntl( fd, F_GETFL, 0 );
+	require( flags != -1, exit );
 
-	FD_ZERO( &ctx->readfds );
-	FD_ZERO( &ctx->writefds );
-	ctx->maxFd = -1;
-	for ( i = 0; i < LWIP_SELECT_MAXNFDS; i++ )
+	flags |= O_NONBLOCK;
+	err = fcntl( fd, F_SETFL, flags );
+	require( err == 0, exit );
+
+	// add it to our kqueue
+#if ASYNC_NETIO_USE_KQUEUE
+
+#ifdef EV_SET64
+
+	struct kevent64_s	kv;
+	EV_SET64( &kv, fd, EVFILT_READ, EV_ADD, 0, 0, (uint64_t)AsyncIO_Handle( anio ), 0, 0 );
+	err = kevent64( anio->loop->kq, &kv, 1, NULL, 0, 0, NULL );
+
+#else
+
+	struct kevent	kv;
+	EV_SET( &kv, fd, EVFILT_READ, EV_ADD, 0, 0, (void*)AsyncIO_Handle( anio ) );
+	err = kevent( anio->loop->kq, &kv, 1, NULL, 0, NULL );
+
+#endif
+
+	require( err == 0, exit );
+#endif
+#if ASYNC_NETIO_USE_EPOLL
+	// listeners stay registered until they're released
+	anio->notifyOnRead = true;
+	err = AsyncIO_UpdateEpollRegistration( anio );
+	require( err == 0, exit );
+#endif
+#if ASYNC_NETIO_USE_POLL
+	anio->notifyOnRead = true;
+	err = AsyncIO_UpdatePollRegistration( anio );
+	require( err == 0, exit );
+#endif
+#if ASYNC_NETIO_USE_SELECT
+	lwip_socket_set_userdata( fd, anio );
+	FD_SET( fd, &anio->loop->readSet );
+#endif
+
+	// the loop's already shedding load, so this one waits too
+	if ( anio->loop->shedding )
 	{
-		if ( FD_ISSET( i, &anioReadSet ) )
-		{
-			ctx->maxFd = i;
-			FD_SET( i, &ctx->readfds );
-		}
-		if ( FD_ISSET( i, &anioWriteSet ) )
-		{
-			ctx->maxFd = i;
-			FD_SET( i, &ctx->writefds );
-		}
+		AsyncIO_PauseListener( anio, true );
 	}
 
-	// if there's nothing to monitor, we can't do anything here
-	//require( maxFd != -1, exit );
-	
-	struct timeval aio_timeout;
-	aio_next_enabled_timer = NULL;
-	AsyncIO_GetNextTimerFireTime( &aio_timeout, &aio_next_enabled_timer );
-	if ( aio_next_enabled_timer != NULL )
+	ASYNC_NETIO_PRIME_RUN_LOOP();
+	result = anio;
+	anio = NULL;
+
+exit:
+
+	ForgetAsyncIOObject( &anio );
+
+	return result;
+}
+
+AsyncIO		AsyncIO_NewTimer( AsyncIOEvent eventCallback, void * userData )
+{
+	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
+
+	anio = AsyncIO_NewObject( AsyncIO_CurrentLoop(), -1, kAIO_TYPE_TIMER, eventCallback, userData );
+	require( anio != NULL, exit );
+
+	anio->timer.handler = AsyncIO_TimerFired;
+
+	result = anio;
+	anio = NULL;
+
+exit:
+
+	ForgetAsyncIOObject( &anio );
+
+	return result;
+}
+
+static inline uint64_t	AsyncIO_Milliseconds( void )
+{
+	return NanosecondCounter() / ( 1000 * 1000 );
+}
+
+static void	AsyncIO_TimerWheelLink( AsyncIOTimerWheel *wheel, AsyncIOTimerEntry *entry, int slot )
+{
+	entry->slot = (uint16_t)slot;
+	entry->next = wheel->slots[slot];
+	if ( entry->next != NULL )
 	{
-		to = &aio_timeout;
-		if ( timeout != NULL )
-		{
-			if (
-				( aio_timeout.tv_sec > timeout->tv_sec ) ||
-				( ( aio_timeout.tv_sec == timeout->tv_sec ) && ( aio_timeout.tv_nsec > timeout->tv_nsec ) )
-				)
-			{
-				to = timeout;
-			}
-		}
+		entry->next->prev = &entry->next;
 	}
+	entry->prev = &wheel->slots[slot];
+	wheel->slots[slot] = entry;
 
-	require( ( ctx->maxFd >= 0 ) || ( to != NULL ), exit );
+	wheel->occupied[slot / kAIOTimerWheelSlots] |= ( 1ULL << ( slot & ( kAIOTimerWheelSlots - 1 ) ) );
+}
 
-	if ( ctx->maxFd == -1 )
+static void	AsyncIO_TimerWheelInsert( AsyncIOTimerWheel *wheel, AsyncIOTimerEntry *entry )
+{
+	uint64_t when = entry->expires;
+	uint64_t index = 0;
+	int level, slot;
+
+	// the current slot has already been run, so anything that's due goes in the next one
+	if ( when <= wheel->current )
 	{
-		ctx->num = select( 0, NULL, NULL, NULL, to );
+		when = wheel->current + 1;
 	}
-	else
+
+	// the finest level that can still tell this apart from now
+	for ( level = 0; level < kAIOTimerWheelLevels; level++ )
 	{
-		ctx->num = select( ctx->maxFd+1, &ctx->readfds, &ctx->writefds, NULL, to );
+		index = when >> ( level * kAIOTimerWheelBits );
+		if ( ( index - ( wheel->current >> ( level * kAIOTimerWheelBits ) ) ) < kAIOTimerWheelSlots )
+			break;
 	}
-#endif
 
-#if ASYNC_NETIO_USE_KQUEUE
-	struct timespec	*to;
-	struct timespec timeout_spec;
-	
-	if ( timeout == NULL )
+	if ( level == kAIOTimerWheelLevels )
 	{
-		to = NULL;
+		level = kAIOTimerWheelLevels - 1;
+		index = ( wheel->current >> ( level * kAIOTimerWheelBits ) ) + ( kAIOTimerWheelSlots - 1 );
 	}
-	else
+
+	slot = ( level * kAIOTimerWheelSlots ) + (int)( index & ( kAIOTimerWheelSlots - 1 ) );
+
+	AsyncIO_TimerWheelLink( wheel, entry, slot );
+}
+
+static void	AsyncIO_TimerWheelRemove( AsyncIOTimerWheel *wheel, AsyncIOTimerEntry *entry )
+{
+	*entry->prev = entry->next;
+	if ( entry->next != NULL )
 	{
-		timeout_spec.tv_sec = timeout->tv_sec;
-		timeout_spec.tv_nsec = timeout->tv_usec * 1000;
-		to = &timeout_spec;
+		entry->next->prev = entry->prev;
+	}
+
+	if ( wheel->slots[entry->slot] == NULL )
+	{
+		wheel->occupied[entry->slot / kAIOTimerWheelSlots] &= ~( 1ULL << ( entry->slot & ( kAIOTimerWheelSlots - 1 ) ) );
+	}
+
+	entry->next = NULL;
+	entry->prev = NULL;
+}
+
+// when the wheel next has something to do -- either fire a level 0 slot, or cascade a higher one
+//	(so this can be early, but never late)
+static uint64_t	AsyncIO_TimerWheelNextEvent( AsyncIOTimerWheel *wheel )
+{
+	uint64_t result = UINT64_MAX;
+	int level;
+
+	for ( level = 0; level < kAIOTimerWheelLevels; level++ )
+	{
+		uint64_t map = wheel->occupied[level];
+		if ( map == 0 )
+			continue;
+
+		// rotate so bit 0 is the slot after the current one
+		uint64_t base = wheel->current >> ( level * kAIOTimerWheelBits );
+		unsigned int pos = (unsigned int)( ( base + 1 ) & ( kAIOTimerWheelSlots - 1 ) );
+		uint64_t rotated = ( map >> pos ) | ( map << ( ( kAIOTimerWheelSlots - pos ) & ( kAIOTimerWheelSlots - 1 ) ) );
+
+		uint64_t when = ( base + 1 + __builtin_ctzll( rotated ) ) << ( level * kAIOTimerWheelBits );
+		if ( when < result )
+		{
+			result = when;
+		}
+	}
+
+	return result;
+}
+
+static void	AsyncIO_ArmTimerEntry( AsyncIOLoop loop, AsyncIOTimerEntry *entry, uint64_t expires )
+{
+	if ( entry->prev != NULL )
+	{
+		AsyncIO_TimerWheelRemove( &loop->timers, entry );
 	}
 
-	errno = 0;
-#ifdef EV_SET64
-	ctx->num = kevent64( anioKQ, NULL, 0, ctx->kv, kMaxAsyncIOEvents, 0, to );
+	entry->expires = expires;
+	AsyncIO_TimerWheelInsert( &loop->timers, entry );
+}
+
+static void	AsyncIO_CancelTimerEntry( AsyncIOLoop loop, AsyncIOTimerEntry *entry )
+{
+	if ( entry->prev != NULL )
+	{
+		AsyncIO_TimerWheelRemove( &loop->timers, entry );
+	}
+}
+
+// milliseconds until the wheel needs attention, or -1 if nothing is armed
+static int64_t	AsyncIO_TimerWheelTimeout( AsyncIOLoop loop )
+{
+	uint64_t next = AsyncIO_TimerWheelNextEvent( &loop->timers );
+	uint64_t now;
+
+	if ( next == UINT64_MAX )
+		return -1;
+
+	now = AsyncIO_Milliseconds();
+
+	return ( next > now ) ? (int64_t)( next - now ) : 0;
+}
+
+// the caller's timeout, shortened if the wheel is due first -- returns NULL to wait forever
+static struct timeval *	AsyncIO_TimerTimeout( AsyncIOLoop loop, struct timeval *timeout, struct timeval *storage )
+{
+	int64_t timer_ms = AsyncIO_TimerWheelTimeout( loop );
+
+	if ( timer_ms >= 0 )
+	{
+		storage->tv_sec = (time_t)( timer_ms / 1000 );
+		storage->tv_usec = (suseconds_t)( ( timer_ms % 1000 ) * 1000 );
+
+		if ( ( timeout == NULL ) || ( timercmp( storage, timeout, < ) ) )
+		{
+			timeout = storage;
+		}
+	}
+
+	return timeout;
+}
+
+// runs the wheel up to now, returns the number of timers that fired
+static int	AsyncIO_RunTimerWheel( AsyncIOLoop loop, uint64_t now )
+{
+	AsyncIOTimerWheel *wheel = &loop->timers;
+	uint64_t next;
+	int fired = 0;
+	int level, slot;
+
+	// skip straight to the next occupied slot rather than ticking through every millisecond
+	while ( ( next = AsyncIO_TimerWheelNextEvent( wheel ) ) <= now )
+	{
+		wheel->current = next;
+
+		// coarsest first, so entries can drop more than one level at once
+		for ( level = kAIOTimerWheelLevels - 1; level > 0; level-- )
+		{
+			if ( ( next & ( ( 1ULL << ( level * kAIOTimerWheelBits ) ) - 1 ) ) != 0 )
+				continue;
+
+			slot = ( level * kAIOTimerWheelSlots ) + (int)( ( next >> ( level * kAIOTimerWheelBits ) ) & ( kAIOTimerWheelSlots - 1 ) );
+
+			AsyncIOTimerEntry *list = wheel->slots[slot];
+			wheel->slots[slot] = NULL;
+			wheel->occupied[level] &= ~( 1ULL << ( slot & ( kAIOTimerWheelSlots - 1 ) ) );
+
+			// the ones due right now go straight into the slot that's about to run -- inserting
+			//	them would push them to the next one, since it counts as already run
+			while ( list != NULL )
+			{
+				AsyncIOTimerEntry *entry = list;
+				list = entry->next;
+				if ( entry->expires <= next )
+					AsyncIO_TimerWheelLink( wheel, entry, (int)( next & ( kAIOTimerWheelSlots - 1 ) ) );
+				else
+					AsyncIO_TimerWheelInsert( wheel, entry );
+			}
+		}
+
+		// the handlers can arm and cancel anything (including what's left in this slot),
+		//	but nothing new can land here since the slot is now in the past
+		slot = (int)( next & ( kAIOTimerWheelSlots - 1 ) );
+		while ( wheel->slots[slot] != NULL )
+		{
+			AsyncIOTimerEntry *entry = wheel->slots[slot];
+			AsyncIO_TimerWheelRemove( wheel, entry );
+			if ( loop->stats != NULL )
+			{
+				uint64_t due = entry->expires * 1000, late = AsyncIO_Microseconds();
+				AsyncIO_StatsRecord( &loop->stats->timerLateness, ( late > due ) ? ( late - due ) : 0 );
+			}
+			(*(entry->handler))( loop, entry );
+			fired++;
+		}
+	}
+
+	if ( now > wheel->current )
+	{
+		wheel->current = now;
+	}
+
+	return fired;
+}
+
+static int	AsyncIO_FireTimers( AsyncIOLoop loop )
+{
+	return AsyncIO_RunTimerWheel( loop, AsyncIO_Milliseconds() );
+}
+
+static uint64_t	AsyncIO_CoalesceDeadline( uint64_t expires, uint32_t leeway );
+
+static void	AsyncIO_TimerFired( AsyncIOLoop loop, AsyncIOTimerEntry *entry )
+{
+	AsyncIO tio = (AsyncIO)( (uint8_t*)entry - offsetof( struct OpaqueAsyncIO, timer ) );
+
+	// it's already been removed from the wheel -- a repeating one goes back in before the
+	//	callback (which can still disable it), on the schedule rather than relative to now, and
+	//	if we've fallen more than a whole interval behind, the missed ones are skipped
+	if ( tio->timerInterval > 0 )
+	{
+		uint64_t now = AsyncIO_Milliseconds();
+
+		tio->timerDue += tio->timerInterval;
+		if ( tio->timerDue <= now )
+		{
+			tio->timerDue += ( ( ( now - tio->timerDue ) / tio->timerInterval ) + 1 ) * tio->timerInterval;
+		}
+
+		AsyncIO_ArmTimerEntry( loop, entry, AsyncIO_CoalesceDeadline( tio->timerDue, tio->timerLeeway ) );
+	}
+
+	loop->inProgress = tio;
+	AsyncIO_CallBack( tio, kAIO_TIMER_FIRED, -1 );
+	loop->inProgress = NULL;
+}
+
+#if ASYNC_NETIO_USE_RUN_LOOP
+static void	AsyncIO_ArmKernelTimer( AsyncIOLoop loop )
+{
+	uint64_t deadline = AsyncIO_TimerWheelNextEvent( &loop->timers );
+	int err;
+
+	require_quiet( deadline != loop->kernelTimerDeadline, exit );
+
+#ifdef EV_SET64
+	struct kevent64_s	kv;
+#else
+	struct kevent	kv;
+#endif
+
+	if ( deadline == UINT64_MAX )
+	{
+#ifdef EV_SET64
+		EV_SET64( &kv, (uint64_t)loop, EVFILT_TIMER, EV_DELETE, 0, 0, (uint64_t)AsyncIO_Handle( loop->wakeup ), 0, 0 );
+		err = kevent64( loop->kq, &kv, 1, NULL, 0, 0, NULL );
+#else
+		EV_SET( &kv, (uintptr_t)loop, EVFILT_TIMER, EV_DELETE, 0, 0, (void*)AsyncIO_Handle( loop->wakeup ) );
+		err = kevent( loop->kq, &kv, 1, NULL, 0, NULL );
+#endif
+		require( ( err == 0 ) || ( errno == ENOENT ), exit );
+	}
+	else
+	{
+		uint64_t now = AsyncIO_Milliseconds();
+		int64_t ms = ( deadline > now ) ? (int64_t)( deadline - now ) : 0;
+#ifdef EV_SET64
+		EV_SET64( &kv, (uint64_t)loop, EVFILT_TIMER, EV_ADD | EV_ENABLE | EV_ONESHOT, 0, ms, (uint64_t)AsyncIO_Handle( loop->wakeup ), 0, 0 );
+		err = kevent64( loop->kq, &kv, 1, NULL, 0, 0, NULL );
+#else
+		EV_SET( &kv, (uintptr_t)loop, EVFILT_TIMER, EV_ADD | EV_ENABLE | EV_ONESHOT, 0, ms, (void*)AsyncIO_Handle( loop->wakeup ) );
+		err = kevent( loop->kq, &kv, 1, NULL, 0, NULL );
+#endif
+		require( err == 0, exit );
+	}
+
+	loop->kernelTimerDeadline = deadline;
+
+exit:
+	;
+}
+#endif
+
+// somewhere in [expires, expires + leeway], on the coarsest power of two boundary that fits -- so
+//	timers whose windows overlap mostly land on the same millisecond, and share a wakeup
+static uint64_t	AsyncIO_CoalesceDeadline( uint64_t expires, uint32_t leeway )
+{
+	uint64_t mask;
+
+	if ( leeway == 0 )
+		return expires;
+
+	// there's always a multiple of the largest power of two <= leeway in a window that wide
+	mask = ( 1ULL << ( 31 - __builtin_clz( leeway ) ) ) - 1;
+
+	return ( expires + mask ) & ~mask;
+}
+
+int				AsyncIO_EnableTimer( AsyncIO timer, uint32_t milliseconds )
+{
+	return AsyncIO_EnableTimerWithLeeway( timer, milliseconds, 0 );
+}
+
+int				AsyncIO_EnableTimerWithLeeway( AsyncIO timer, uint32_t milliseconds, uint32_t leeway )
+{
+	int result = -1;
+
+	require( timer != NULL, exit );
+
+	// re-enabling just moves the fire time (and makes it one shot)
+	timer->timerDue = AsyncIO_Milliseconds() + milliseconds;
+	timer->timerInterval = 0;
+	timer->timerLeeway = leeway;
+	AsyncIO_ArmTimerEntry( timer->loop, &timer->timer, AsyncIO_CoalesceDeadline( timer->timerDue, leeway ) );
+
+	ASYNC_NETIO_PRIME_RUN_LOOP();
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIO_EnableRepeatingTimer( AsyncIO timer, uint32_t interval, uint32_t leeway )
+{
+	int result = -1;
+
+	require( timer != NULL, exit );
+	require( interval > 0, exit );
+
+	timer->timerDue = AsyncIO_Milliseconds() + interval;
+	timer->timerInterval = interval;
+	timer->timerLeeway = leeway;
+	AsyncIO_ArmTimerEntry( timer->loop, &timer->timer, AsyncIO_CoalesceDeadline( timer->timerDue, leeway ) );
+
+	ASYNC_NETIO_PRIME_RUN_LOOP();
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int		AsyncIO_DisableTimer( AsyncIO timer )
+{
+	int result = -1;
+
+	require( timer != NULL, exit );
+
+	AsyncIO_CancelTimerEntry( timer->loop, &timer->timer );
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+// whichever's first -- but an entry that's already due sooner is left alone, it'll work out
+//	the rest when it fires
+static void	AsyncIO_ScheduleConnectionTimeout( AsyncIO anio, bool sooner )
+{
+	uint64_t due = UINT64_MAX;
+
+	if ( anio->idleTimeout > 0 )
+	{
+		due = anio->lastActivity + anio->idleTimeout;
+	}
+	if ( anio->deadline != 0 )
+	{
+		due = Minimum( due, anio->deadline );
+	}
+
+	if ( due == UINT64_MAX )
+	{
+		AsyncIO_CancelTimerEntry( anio->loop, &anio->timer );
+	}
+	else if ( !sooner || ( anio->timer.prev == NULL ) || ( due < anio->timer.expires ) )
+	{
+		AsyncIO_ArmTimerEntry( anio->loop, &anio->timer, due );
+	}
+}
+
+static void	AsyncIO_ConnectionTimerFired( AsyncIOLoop loop, AsyncIOTimerEntry *entry )
+{
+	AsyncIO anio = (AsyncIO)( (uint8_t*)entry - offsetof( struct OpaqueAsyncIO, timer ) );
+	uint64_t now = AsyncIO_Milliseconds();
+	int event = 0;
+
+	if ( ( anio->deadline != 0 ) && ( now >= anio->deadline ) )
+	{
+		// only once
+		anio->deadline = 0;
+		event = kAIO_DEADLINE_EXPIRED;
+	}
+	else if ( ( anio->idleTimeout > 0 ) && ( now >= anio->lastActivity + anio->idleTimeout ) )
+	{
+		event = kAIO_IDLE_TIMEOUT;
+	}
+
+	if ( event != 0 )
+	{
+		// (which counts as activity, so if they keep it, it gets another idle period)
+		loop->inProgress = anio;
+		AsyncIO_CallBack( anio, event, anio->fd );
+		if ( loop->inProgress != anio )
+			return;
+		loop->inProgress = NULL;
+	}
+
+	// there was activity since it was armed, or the other one's still to come
+	AsyncIO_ScheduleConnectionTimeout( anio, false );
+}
+
+int		AsyncIO_SetIdleTimeout( AsyncIO anio, uint32_t milliseconds )
+{
+	int result = -1;
+
+	require( anio != NULL, exit );
+	require( anio->type == kAIO_TYPE_CONNECTION, exit );
+
+	anio->timer.handler = AsyncIO_ConnectionTimerFired;
+	anio->idleTimeout = milliseconds;
+	anio->lastActivity = AsyncIO_Milliseconds();
+	AsyncIO_ScheduleConnectionTimeout( anio, milliseconds > 0 );
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int		AsyncIO_SetDeadline( AsyncIO anio, uint32_t milliseconds )
+{
+	int result = -1;
+
+	require( anio != NULL, exit );
+	require( anio->type == kAIO_TYPE_CONNECTION, exit );
+
+	anio->timer.handler = AsyncIO_ConnectionTimerFired;
+	anio->deadline = ( milliseconds > 0 ) ? AsyncIO_Milliseconds() + milliseconds : 0;
+	AsyncIO_ScheduleConnectionTimeout( anio, milliseconds > 0 );
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+#if ASYNC_NETIO_USE_KQUEUE || ASYNC_NETIO_USE_EPOLL
+
+// collects an exited child before its callback, so whoever's supervising doesn't need a waitpid()
+//	of their own -- a process that isn't ours is left alone (and has no status)
+static void	AsyncIO_ReapProcess( AsyncIO anio )
+{
+	int status = 0, err;
+
+	require_quiet( !anio->reaped, exit );
+
+#if ASYNC_NETIO_USE_EPOLL
+	// by pidfd, so there's no question of the pid having been reused
+	siginfo_t info;
+
+	memset( &info, 0, sizeof( info ) );
+	err = waitid( P_PIDFD, (id_t)anio->fd, &info, WEXITED | WNOHANG );
+	if ( ( err == 0 ) && ( info.si_pid != 0 ) )
+	{
+		if ( info.si_code == CLD_EXITED )
+			status = W_EXITCODE( info.si_status, 0 );
+		else
+			status = W_EXITCODE( 0, info.si_status ) | ( ( info.si_code == CLD_DUMPED ) ? WCOREFLAG : 0 );
+
+		anio->exitStatus = status;
+		anio->reaped = true;
+	}
+	require_quiet( ( err != 0 ) && ( errno == EINVAL ), exit );		// (before 5.4)
+#endif
+
+	err = (int)waitpid( (pid_t)anio->monitored, &status, WNOHANG );
+	if ( err == anio->monitored )
+	{
+		anio->exitStatus = status;
+		anio->reaped = true;
+	}
+
+exit:
+	;
+}
+
+#endif
+
+#if TARGET_OS_UNIXLIKE
+int			AsyncIO_GetExitStatus( AsyncIO anio, int *outStatus )
+{
+	int result = -1;
+
+	require( anio != NULL, exit );
+	require( outStatus != NULL, exit );
+	require( anio->type == kAIO_TYPE_PROC, exit );
+	require_quiet( anio->reaped, exit );
+
+	*outStatus = anio->exitStatus;
+	result = 0;
+
+exit:
+
+	return result;
+}
+#endif
+
+#if ASYNC_NETIO_USE_KQUEUE || ASYNC_NETIO_USE_EPOLL
+// what a signal monitor took over from the rest of the process, so releasing it can put things
+//	back the way they were -- and only one monitor per signal, since two would just compete for it
+typedef struct
+{
+	AsyncIO				owner;
+	bool				wasBlocked;			// on the thread that made the monitor
+	struct sigaction	previous;
+} AsyncIOSignalClaim;
+
+static pthread_mutex_t		anioSignalLock = PTHREAD_MUTEX_INITIALIZER;
+static AsyncIOSignalClaim	anioSignalClaims[NSIG];
+
+static int	AsyncIO_ClaimSignal( AsyncIO anio, int sig_id, const struct sigaction *action, bool block )
+{
+	int result = -1;
+	AsyncIOSignalClaim *claim;
+	sigset_t mask, old;
+	int err;
+
+	require_action( ( sig_id > 0 ) && ( sig_id < NSIG ), exit, errno = EINVAL );
+
+	pthread_mutex_lock( &anioSignalLock );
+	claim = &anioSignalClaims[sig_id];
+	require_action_quiet( claim->owner == NULL, unlock, errno = EBUSY );
+
+	claim->wasBlocked = true;
+	if ( block )
+	{
+		sigemptyset( &mask );
+		sigaddset( &mask, sig_id );
+		err = pthread_sigmask( SIG_BLOCK, &mask, &old );
+		require_action( err == 0, unlock, errno = err );
+		claim->wasBlocked = ( sigismember( &old, sig_id ) == 1 );
+	}
+
+	err = sigaction( sig_id, action, &claim->previous );
+	if ( ( err != 0 ) && !claim->wasBlocked )
+	{
+		pthread_sigmask( SIG_UNBLOCK, &mask, NULL );
+	}
+	require( err == 0, unlock );
+
+	claim->owner = anio;
+	anio->monitored = sig_id;
+	result = 0;
+
+unlock:
+
+	pthread_mutex_unlock( &anioSignalLock );
+
+exit:
+
+	return result;
+}
+
+// the previous action comes back, and the signal is unblocked if we blocked it -- on this thread,
+//	so a monitor should be released on the thread that made it
+static void	AsyncIO_ReturnSignal( AsyncIO anio )
+{
+	int sig_id = anio->monitored;
+	AsyncIOSignalClaim *claim;
+	sigset_t mask;
+
+	require_quiet( ( sig_id > 0 ) && ( sig_id < NSIG ), exit );
+
+#if ASYNC_NETIO_USE_KQUEUE
+	// (not closing anything takes the filter out of the kqueue for us)
+#ifdef EV_SET64
+	struct kevent64_s	kv;
+	EV_SET64( &kv, sig_id, EVFILT_SIGNAL, EV_DELETE, 0, 0, 0, 0, 0 );
+	kevent64( anio->loop->kq, &kv, 1, NULL, 0, 0, NULL );
+#else
+	struct kevent	kv;
+	EV_SET( &kv, sig_id, EVFILT_SIGNAL, EV_DELETE, 0, 0, NULL );
+	kevent( anio->loop->kq, &kv, 1, NULL, 0, NULL );
+#endif
+#endif
+
+	pthread_mutex_lock( &anioSignalLock );
+	claim = &anioSignalClaims[sig_id];
+	if ( claim->owner == anio )
+	{
+		sigaction( sig_id, &claim->previous, NULL );
+		if ( !claim->wasBlocked )
+		{
+			sigemptyset( &mask );
+			sigaddset( &mask, sig_id );
+			pthread_sigmask( SIG_UNBLOCK, &mask, NULL );
+		}
+		claim->owner = NULL;
+	}
+	pthread_mutex_unlock( &anioSignalLock );
+
+	anio->monitored = 0;
+
+exit:
+	;
+}
+#endif
+
+#if ASYNC_NETIO_USE_KQUEUE
+AsyncIO		AsyncIO_NewProcessMonitor( pid_t pid, AsyncIOEvent eventCallback, void * userData )
+{
+	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
+
+	anio = AsyncIO_NewObject( AsyncIO_CurrentLoop(), -1, kAIO_TYPE_PROC, eventCallback, userData );
+	require( anio != NULL, exit );
+
+	anio->monitored = pid;
+
+	int err;
+
+#ifdef EV_SET64
+	struct kevent64_s	kv;
+	EV_SET64( &kv, (uint64_t)pid, EVFILT_PROC, EV_ADD | EV_ENABLE | EV_ONESHOT, NOTE_EXIT, 0, (uint64_t)AsyncIO_Handle( anio ), 0, 0 );
+	err = kevent64( anio->loop->kq, &kv, 1, NULL, 0, 0, NULL );
+#else
+	struct kevent	kv;
+	EV_SET( &kv, pid, EVFILT_PROC, EV_ADD | EV_ENABLE | EV_ONESHOT, NOTE_EXIT, 0, (void*)AsyncIO_Handle( anio ) );
+	err = kevent( anio->loop->kq, &kv, 1, NULL, 0, NULL );
+#endif
+	if ( err != 0 )
+	{
+		dlog( kDebugLevelError, "kevent error %d\n", errno );
+	}
+	require( err == 0, exit );
+
+	ASYNC_NETIO_PRIME_RUN_LOOP();
+	result = anio;
+	anio = NULL;
+
+exit:
+
+	ForgetAsyncIOObject( &anio );
+
+	return result;
+}
+
+AsyncIO		AsyncIO_NewSignalMonitor( int sig_id, AsyncIOEvent eventCallback, void * userData )
+{
+	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
+
+	anio = AsyncIO_NewObject( AsyncIO_CurrentLoop(), -1, kAIO_TYPE_SIGNAL, eventCallback, userData );
+	require( anio != NULL, exit );
+
+	int err;
+	struct sigaction action;
+
+	// must set signal to be ignored (process wide -- kqueue still sees it), and it stays
+	//	registered until it's released, same as the signalfd.  releasing it puts back what was there
+	memset( &action, 0, sizeof( action ) );
+	action.sa_handler = SIG_IGN;
+	sigemptyset( &action.sa_mask );
+	err = AsyncIO_ClaimSignal( anio, sig_id, &action, false );
+	require_quiet( err == 0, exit );
+
+#ifdef EV_SET64
+	struct kevent64_s	kv;
+	EV_SET64( &kv, sig_id, EVFILT_SIGNAL, EV_ADD | EV_ENABLE, 0, 0, (uint64_t)AsyncIO_Handle( anio ), 0, 0 );
+	err = kevent64( anio->loop->kq, &kv, 1, NULL, 0, 0, NULL );
+#else
+	struct kevent	kv;
+	EV_SET( &kv, sig_id, EVFILT_SIGNAL, EV_ADD | EV_ENABLE, 0, 0, (void*)AsyncIO_Handle( anio ) );
+	err = kevent( anio->loop->kq, &kv, 1, NULL, 0, NULL );
+#endif
+	if ( err != 0 )
+	{
+		dlog( kDebugLevelError, "kevent error %d\n", errno );
+	}
+	require( err == 0, exit );
+
+	ASYNC_NETIO_PRIME_RUN_LOOP();
+	result = anio;
+	anio = NULL;
+
+exit:
+
+	if ( anio != NULL )
+	{
+		AsyncIO_ReturnSignal( anio );
+	}
+	ForgetAsyncIOObject( &anio );
+
+	return result;
+}
+#elif ASYNC_NETIO_USE_EPOLL
+
+// the Linux versions -- a pidfd for a process (5.3 and later), or a signalfd for a signal, that
+//	sits in the epoll set like anything else
+static AsyncIO	AsyncIO_NewMonitor( int fd, int type, int monitored, AsyncIOEvent eventCallback, void * userData )
+{
+	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
+	int err;
+
+	anio = AsyncIO_NewObject( AsyncIO_CurrentLoop(), fd, type, eventCallback, userData );
+	require( anio != NULL, exit );
+
+	anio->monitored = monitored;
+
+	// stays registered (until the process exits, for a pidfd)
+	anio->notifyOnRead = true;
+	err = AsyncIO_UpdateEpollRegistration( anio );
+	require( err == 0, exit );
+
+	result = anio;
+	anio = NULL;
+
+exit:
+
+	if ( anio != NULL )
+	{
+		anio->notifyOnRead = false;
+		ForgetAsyncIOObject( &anio );
+	}
+
+	return result;
+}
+
+AsyncIO		AsyncIO_NewProcessMonitor( pid_t pid, AsyncIOEvent eventCallback, void * userData )
+{
+	AsyncIO result = NULL;
+	int fd = kInvalidFD;
+
+#ifdef SYS_pidfd_open
+	fd = (int)syscall( SYS_pidfd_open, pid, 0 );
+#else
+	errno = ENOSYS;
+#endif
+	if ( fd < 0 ) { dlog( kDebugLevelError, "AsyncIO: pidfd_open( %d ) error %d\n", (int)pid, errno ); }
+	require_quiet( fd >= 0, exit );
+
+	fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+	result = AsyncIO_NewMonitor( fd, kAIO_TYPE_PROC, pid, eventCallback, userData );
+	require( result != NULL, exit );
+	fd = kInvalidFD;
+
+exit:
+
+	ForgetFD( &fd );
+
+	return result;
+}
+
+static void	AsyncIO_IgnoreSignal( int sig_id )
+{
+	(void)sig_id;
+}
+
+// the signal gets blocked on this thread (our own threads have everything blocked) so it's
+//	delivered through the signalfd -- and since that's per thread, the process-wide action
+//	becomes a handler that does nothing, so one that lands on some other thread that hasn't
+//	blocked it is lost, rather than killing the process.  (SIG_IGN would have the kernel drop
+//	it before the signalfd ever saw it.)  releasing it puts both back.
+AsyncIO		AsyncIO_NewSignalMonitor( int sig_id, AsyncIOEvent eventCallback, void * userData )
+{
+	AsyncIO result = NULL, anio = NULL;
+	struct sigaction action;
+	sigset_t mask;
+	int fd = kInvalidFD, err;
+
+	sigemptyset( &mask );
+	err = sigaddset( &mask, sig_id );
+	require( err == 0, exit );
+
+	fd = signalfd( -1, &mask, SFD_NONBLOCK | SFD_CLOEXEC );
+	require( fd >= 0, exit );
+
+	anio = AsyncIO_NewMonitor( fd, kAIO_TYPE_SIGNAL, 0, eventCallback, userData );
+	require( anio != NULL, exit );
+	fd = kInvalidFD;
+
+	memset( &action, 0, sizeof( action ) );
+	action.sa_handler = AsyncIO_IgnoreSignal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset( &action.sa_mask );
+	err = AsyncIO_ClaimSignal( anio, sig_id, &action, true );
+	require_quiet( err == 0, exit );
+
+	result = anio;
+	anio = NULL;
+
+exit:
+
+	ForgetAsyncIO( &anio, true );
+	ForgetFD( &fd );
+
+	return result;
+}
+
+static void	AsyncIO_DispatchMonitor( AsyncIOLoop loop, AsyncIO anio )
+{
+	loop->inProgress = anio;
+
+	if ( anio->type == kAIO_TYPE_PROC )
+	{
+		// it only exits once -- a pidfd would stay readable, so stop listening, just like EV_ONESHOT
+		anio->notifyOnRead = false;
+		AsyncIO_MarkEpollDirty( anio );
+
+		// (normally already done, along with the rest of its batch)
+		AsyncIO_ReapProcess( anio );
+
+		AsyncIO_CallBack( anio, kAIO_PROCESS_EXITED, anio->monitored );
+	}
+	else
+	{
+		struct signalfd_siginfo info[16];
+		ssize_t num;
+		size_t i;
+
+		// take everything that's arrived in one go -- the callback can release us part way through
+		while ( ( loop->inProgress == anio ) && ( ( num = read( anio->fd, info, sizeof( info ) ) ) > 0 ) )
+		{
+			for ( i = 0; ( i < ( num / sizeof( info[0] ) ) ) && ( loop->inProgress == anio ); i++ )
+			{
+				AsyncIO_CallBack( anio, kAIO_SIGNAL_DELIVERED, (int)info[i].ssi_signo );
+			}
+		}
+	}
+
+	loop->inProgress = NULL;
+}
+
+#elif ASYNC_NETIO_USE_POLL
+
+// there's no descriptor to poll() for either of these
+AsyncIO		AsyncIO_NewProcessMonitor( pid_t pid, AsyncIOEvent eventCallback, void * userData )
+{
+	(void)pid;
+	(void)eventCallback;
+	(void)userData;
+
+	errno = ENOTSUP;
+	return NULL;
+}
+
+AsyncIO		AsyncIO_NewSignalMonitor( int signalID, AsyncIOEvent eventCallback, void * userData )
+{
+	(void)signalID;
+	(void)eventCallback;
+	(void)userData;
+
+	errno = ENOTSUP;
+	return NULL;
+}
+#endif
+
+
+static AsyncIO		AsyncIO_NewConnectionObject( int fd, bool nonBlocking, AsyncIOEvent eventCallback, void * userData )
+{
+	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
+
+	anio = AsyncIO_NewObject( AsyncIO_CurrentLoop(), fd, kAIO_TYPE_CONNECTION, eventCallback, userData );
+	require( anio != NULL, exit );
+
+	// make sure socket is in non-blocking mode
+	if ( !nonBlocking )
+	{
+		int flags, err;
+		flags = fcntl( fd, F_GETFL, 0 );
+		require( flags != -1, exit );
+
+		flags |= O_NONBLOCK;
+//#if !TARGET_OS_FREERTOS
+//		flags |= O_ASYNC;
+//#endif
+		err = fcntl( fd, F_SETFL, flags );
+		if ( err != 0 ) { dlog( kDebugLevelError, "AsyncIO: fcntl( %d, F_SETFL, 0x%08X): error = %d\r\n", fd, flags, errno ); }
+		if ( ( err != 0 ) && ( errno == ENOTTY ) ) { err = 0; }
+		require( err == 0, exit );
+	}
+
+#if ASYNC_NETIO_USE_SELECT
+	lwip_socket_set_userdata( fd, anio );
+#endif
+
+	result = anio;
+	anio = NULL;
+
+exit:
+
+	ForgetAsyncIOObject( &anio );
+
+	return result;
+}
+
+AsyncIO		AsyncIO_NewConnection( int fd, AsyncIOEvent eventCallback, void * userData )
+{
+	return AsyncIO_NewConnectionObject( fd, false, eventCallback, userData );
+}
+
+// it's already non-blocking, so there's nothing to ask the kernel
+AsyncIO		AsyncIO_NewAcceptedConnection( int fd, AsyncIOEvent eventCallback, void * userData )
+{
+	return AsyncIO_NewConnectionObject( fd, true, eventCallback, userData );
+}
+
+int				AsyncIO_NotifyOnReadability( AsyncIO anio )
+{
+	int result = -1;
+
+	require( anio != NULL, exit );
+
+#if ASYNC_NETIO_USE_SELECT || ASYNC_NETIO_USE_POLL
+	int err;
+#endif
+#if ASYNC_NETIO_USE_KQUEUE
+	require( anio->loop->kq >= 0, exit );
+
+	// goes in with the next wait -- and if it's already armed (or queued), there's nothing to do
+	if ( !anio->notifyOnRead )
+	{
+		AsyncIO_QueueChange( anio, EVFILT_READ, anio->persistent ? ( EV_ADD | EV_CLEAR ) : ( EV_ADD | EV_ONESHOT ) );
+	}
+#endif
+#if ASYNC_NETIO_USE_EPOLL
+	anio->notifyOnRead = true;
+	AsyncIO_MarkEpollDirty( anio );
+#endif
+#if ASYNC_NETIO_USE_POLL
+	anio->notifyOnRead = true;
+	err = AsyncIO_UpdatePollRegistration( anio );
+	require_action( err == 0, exit, anio->notifyOnRead = false );
+#endif
+#if ASYNC_NETIO_USE_SELECT
+	err = lwip_socket_set_userdata( anio->fd, anio );
+	require( err == 0, exit );
+	FD_SET( anio->fd, &anio->loop->readSet );
+#endif
+
+	ASYNC_NETIO_PRIME_RUN_LOOP();
+	anio->notifyOnRead = true;
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+static int		AsyncIO_ArmWritability( AsyncIO anio )
+{
+	int result = -1;
+
+	require( anio != NULL, exit );
+
+#if ASYNC_NETIO_USE_SELECT || ASYNC_NETIO_USE_POLL
+	int err;
+#endif
+#if ASYNC_NETIO_USE_KQUEUE
+
+	require( anio->loop->kq >= 0, exit );
+
+	if ( !anio->notifyOnWrite )
+	{
+		AsyncIO_QueueChange( anio, EVFILT_WRITE, anio->persistent ? ( EV_ADD | EV_CLEAR ) : ( EV_ADD | EV_ONESHOT ) );
+	}
+#endif
+#if ASYNC_NETIO_USE_EPOLL
+	anio->notifyOnWrite = true;
+	AsyncIO_MarkEpollDirty( anio );
+#endif
+#if ASYNC_NETIO_USE_POLL
+	anio->notifyOnWrite = true;
+	err = AsyncIO_UpdatePollRegistration( anio );
+	require_action( err == 0, exit, anio->notifyOnWrite = false );
+#endif
+#if ASYNC_NETIO_USE_SELECT
+	err = lwip_socket_set_userdata( anio->fd, anio );
+	require( err == 0, exit );
+	FD_SET( anio->fd, &anio->loop->writeSet );
+#endif
+
+	ASYNC_NETIO_PRIME_RUN_LOOP();
+	anio->notifyOnWrite = true;
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIO_SetPersistentNotifications( AsyncIO anio, bool persistent )
+{
+	int result = -1;
+
+	require( anio != NULL, exit );
+	require( anio->type == kAIO_TYPE_CONNECTION, exit );
+
+	// the kernel won't change an existing filter between oneshot and edge-triggered, so
+	//	this has to happen before anything is armed
+	require( !anio->notifyOnRead && !anio->notifyOnWrite, exit );
+
+#if ASYNC_NETIO_USE_SELECT || ASYNC_NETIO_USE_POLL
+	// select and poll are level-triggered only (a writable socket would never let the loop rest)
+	require( !persistent, exit );
+#endif
+
+#if ASYNC_NETIO_USE_IO_URING
+	require( !anio->completionReads, exit );
+#endif
+
+	anio->persistent = persistent;
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIO_SetAcceptBatch( AsyncIO anio, int budget )
+{
+	int result = -1;
+
+	require( anio != NULL, exit );
+	require( anio->type == kAIO_TYPE_LISTENER, exit );
+	require( budget >= 0, exit );
+
+	anio->acceptBudget = budget;
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIO_NotifyOnWritability( AsyncIO anio )
+{
+	// on a buffered stream (or while sending a file), this means "once the output has drained"
+	if ( anio != NULL )
+	{
+		anio->writeRequested = true;
+	}
+
+	return AsyncIO_ArmWritability( anio );
+}
+
+// the filled part of the ring, as up to two spans
+static int		AsyncIO_RingSpans( AsyncIORing *ring, struct iovec *iov )
+{
+	size_t first = ring->size - ring->head;
+
+	if ( ring->count == 0 )
+		return 0;
+
+	iov[0].iov_base = &ring->data[ring->head];
+	if ( ring->count <= first )
+	{
+		iov[0].iov_len = ring->count;
+		return 1;
+	}
+
+	iov[0].iov_len = first;
+	iov[1].iov_base = ring->data;
+	iov[1].iov_len = ring->count - first;
+	return 2;
+}
+
+// and the empty part
+static int		AsyncIO_RingFreeSpans( AsyncIORing *ring, struct iovec *iov )
+{
+	size_t tail = ( ring->head + ring->count ) % ring->size;
+	size_t space = ring->size - ring->count;
+
+	if ( space == 0 )
+		return 0;
+
+	iov[0].iov_base = &ring->data[tail];
+	if ( space <= ( ring->size - tail ) )
+	{
+		iov[0].iov_len = space;
+		return 1;
+	}
+
+	iov[0].iov_len = ring->size - tail;
+	iov[1].iov_base = ring->data;
+	iov[1].iov_len = space - iov[0].iov_len;
+	return 2;
+}
+
+static void		AsyncIO_RingConsume( AsyncIORing *ring, size_t amount )
+{
+	ring->count -= amount;
+
+	// start over at the front when it empties, so the free space is all in one piece
+	ring->head = ( ring->count == 0 ) ? 0 : ( ring->head + amount ) % ring->size;
+}
+
+static size_t	AsyncIO_RingCopyOut( AsyncIORing *ring, void *buffer, size_t length )
+{
+	struct iovec iov[2];
+	size_t copied = 0;
+	int i, num;
+
+	num = AsyncIO_RingSpans( ring, iov );
+	for ( i = 0; ( i < num ) && ( copied < length ); i++ )
+	{
+		size_t amount = Minimum( iov[i].iov_len, ( length - copied ) );
+		memcpy( (uint8_t*)buffer + copied, iov[i].iov_base, amount );
+		copied += amount;
+	}
+
+	AsyncIO_RingConsume( ring, copied );
+	return copied;
+}
+
+static size_t	AsyncIO_RingCopyIn( AsyncIORing *ring, const void *data, size_t length )
+{
+	struct iovec iov[2];
+	size_t copied = 0;
+	int i, num;
+
+	num = AsyncIO_RingFreeSpans( ring, iov );
+	for ( i = 0; ( i < num ) && ( copied < length ); i++ )
+	{
+		size_t amount = Minimum( iov[i].iov_len, ( length - copied ) );
+		memcpy( iov[i].iov_base, (const uint8_t*)data + copied, amount );
+		copied += amount;
+	}
+
+	ring->count += copied;
+	return copied;
+}
+
+static int		AsyncIO_RingResize( AsyncIORing *ring, size_t size )
+{
+	int result = -1;
+	uint8_t *data;
+
+	require( ring->count == 0, exit );
+
+	data = realloc( ring->data, size );
+	require( data != NULL, exit );
+
+	ring->data = data;
+	ring->size = size;
+	ring->head = 0;
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+static AsyncIOStream *	AsyncIO_GetStream( AsyncIO anio )
+{
+	AsyncIOStream *stream = anio->stream;
+
+	require_quiet( stream == NULL, exit );
+
+	stream = calloc( 1, sizeof( AsyncIOStream ) );
+	require( stream != NULL, exit );
+
+	if ( ( AsyncIO_RingResize( &stream->input, kAsyncIODefaultStreamBufferSize ) != 0 ) ||
+		 ( AsyncIO_RingResize( &stream->output, kAsyncIODefaultStreamBufferSize ) != 0 ) )
+	{
+		ForgetMem( &stream->input.data );
+		ForgetMem( &stream->output.data );
+		ForgetMem( &stream );
+		goto exit;
+	}
+
+	anio->stream = stream;
+
+exit:
+
+	return stream;
+}
+
+static void		AsyncIO_ForgetStream( AsyncIO anio )
+{
+	if ( anio->stream != NULL )
+	{
+		ForgetMem( &anio->stream->input.data );
+		ForgetMem( &anio->stream->output.data );
+		ForgetMem( &anio->stream );
+	}
+}
+
+#if TARGET_OS_UNIXLIKE
+	#define AsyncIO_SendingFile( anio )		( (anio)->sendFile != NULL )
+#else
+	#define AsyncIO_SendingFile( anio )		false
+#endif
+
+// one writev of what's queued (up to limit) -- a short write means the socket is full again
+static size_t	AsyncIO_FlushOutput( AsyncIO anio, size_t limit )
+{
+	AsyncIOStream *stream = anio->stream;
+	struct iovec iov[2];
+	ssize_t written = 0;
+	int num;
+
+	num = AsyncIO_RingSpans( &stream->output, iov );
+	require_quiet( ( num > 0 ) && ( limit > 0 ), exit );
+
+	if ( iov[0].iov_len >= limit )
+	{
+		iov[0].iov_len = limit;
+		num = 1;
+	}
+	else if ( num > 1 )
+	{
+		iov[1].iov_len = Minimum( iov[1].iov_len, ( limit - iov[0].iov_len ) );
+	}
+
+	written = writev( anio->fd, iov, num );
+	if ( written >= 0 )
+	{
+		AsyncIO_RingConsume( &stream->output, written );
+	}
+	else if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) && ( errno != EINTR ) )
+	{
+		dlog( kDebugLevelTrace, "AsyncIO: output for %d failed: %d\n", anio->fd, errno );
+		stream->outputError = errno;
+		AsyncIO_RingConsume( &stream->output, stream->output.count );
+	}
+
+exit:
+
+	return ( written > 0 ) ? written : 0;
+}
+
+#if TARGET_OS_UNIXLIKE
+// true once the file's done (and the completion has been called), false if it's waiting for room
+static bool		AsyncIO_PumpSendFile( AsyncIO anio )
+{
+	AsyncIOSendFile *sendFile = anio->sendFile;
+	size_t burst = 0;
+	ssize_t sent;
+	int err = 0;
+
+	sendFile->full = false;
+
+	while ( sendFile->remaining > 0 )
+	{
+		size_t chunk = Minimum( sendFile->remaining, ( kAsyncIOSendFileBurst - burst ) );
+
+		if ( chunk == 0 )
+			return false;
+
+#if TARGET_OS_LINUX
+		off_t offset = sendFile->offset;
+		sent = sendfile( anio->fd, sendFile->fd, &offset, chunk );
+#elif __APPLE__
+		// a short send reports EAGAIN, but still tells us how much went
+		off_t length = chunk;
+		sent = sendfile( sendFile->fd, anio->fd, sendFile->offset, &length, NULL, 0 );
+		if ( length > 0 )
+			sent = length;
+#else
+		sent = -1;
+		errno = ENOTSUP;
+#endif
+
+		if ( sent > 0 )
+		{
+			sendFile->offset += sent;
+			sendFile->sent += sent;
+			sendFile->remaining -= sent;
+			burst += sent;
+		}
+		else if ( sent == 0 )
+		{
+			// the file's shorter than we were told
+			break;
+		}
+		else if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+		{
+			sendFile->full = true;
+			return false;
+		}
+		else if ( errno != EINTR )
+		{
+			err = errno;
+			dlog( kDebugLevelTrace, "AsyncIO: sendfile for %d failed: %d\n", anio->fd, err );
+			break;
+		}
+	}
+
+	anio->sendFile = NULL;
+	(*(sendFile->completion))( anio, sendFile->fd, sendFile->sent, err, sendFile->userData );
+	ForgetMem( &sendFile );
+
+	return true;
+}
+
+#if ASYNC_NETIO_USE_KQUEUE || ASYNC_NETIO_USE_EPOLL
+static void		AsyncIO_DeliverWritable( AsyncIO anio, int ident );
+static void		AsyncIOLoop_PostTask( AsyncIOLoop loop, AsyncIOTask *task );
+
+static void		AsyncIO_ResumeSendFile( void * context )
+{
+	AsyncIOSendFileResume *resume = (AsyncIOSendFileResume*)context;
+	AsyncIOLoop loop = resume->loop;
+	AsyncIO anio = AsyncIO_FromHandle( loop, resume->handle );
+
+	// released, or the file went some other way in the meantime
+	if ( ( anio == NULL ) || ( anio->sendFile == NULL ) )
+		return;
+
+	loop->inProgress = anio;
+	AsyncIO_DeliverWritable( anio, anio->fd );
+	loop->inProgress = NULL;
+
+	// the task (which is the resume) goes when this returns
+}
+
+static int		AsyncIO_PostSendFileResume( AsyncIO anio )
+{
+	int result = -1;
+	AsyncIOSendFileResume *resume;
+
+	resume = calloc( 1, sizeof( AsyncIOSendFileResume ) );
+	require_action( resume != NULL, exit, errno = ENOMEM );
+
+	resume->loop = anio->loop;
+	resume->handle = AsyncIO_Handle( anio );
+	resume->post.function = AsyncIO_ResumeSendFile;
+	resume->post.context = resume;
+	AsyncIOLoop_PostTask( anio->loop, &resume->post );
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+#endif
+#endif
+
+// non-blocking and close-on-exec from the start where there's accept4(), otherwise it takes the fcntl()s
+static int		AsyncIO_Accept( int listenFD )
+{
+#if defined( SOCK_NONBLOCK ) && defined( SOCK_CLOEXEC )
+	return accept4( listenFD, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+#else
+	int fd = accept( listenFD, NULL, NULL );
+
+	if ( fd >= 0 )
+	{
+		fcntl( fd, F_SETFL, fcntl( fd, F_GETFL, 0 ) | O_NONBLOCK );
+#ifdef FD_CLOEXEC
+		fcntl( fd, F_SETFD, FD_CLOEXEC );
+#endif
+	}
+
+	return fd;
+#endif
+}
+
+// a listener either gets kAIO_NEW_CONNECTION and accepts for itself, or (with an accept batch)
+//	we drain the backlog for it -- up to the budget, so a storm on one listener can't starve the
+//	rest of the loop (it's level-triggered, so whatever's left comes back on the next wakeup)
+static void		AsyncIO_DeliverNewConnections( AsyncIO anio, int ident )
+{
+	AsyncIOLoop loop = anio->loop;
+	int i, fd;
+
+	if ( anio->acceptBudget == 0 )
+	{
+		AsyncIO_CallBack( anio, kAIO_NEW_CONNECTION, ident );
+		return;
+	}
+
+	// the callback can release the listener part way through
+	for ( i = 0; ( i < anio->acceptBudget ) && ( loop->inProgress == anio ); i++ )
+	{
+		fd = AsyncIO_Accept( ident );
+		if ( fd < 0 )
+		{
+			// gone before we got to it, there may be more behind it
+			if ( ( errno == ECONNABORTED ) || ( errno == EINTR ) )
+				continue;
+
+			if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) ) { dlog( kDebugLevelError, "AsyncIO: accept( %d ) error %d\n", ident, errno ); }
+			break;
+		}
+
+		AsyncIO_CallBack( anio, kAIO_CONNECTION_ACCEPTED, fd );
+	}
+}
+
+// writability on a buffered stream (or one sending a file) goes to the output first -- in order,
+//	what was queued before the file, the file, and what was queued after it.  the callback only
+//	hears about it once that's all gone, and only if it asked
+static void		AsyncIO_DeliverWritable( AsyncIO anio, int ident )
+{
+	AsyncIOStream *stream = anio->stream;
+	bool gated = ( stream != NULL );		// output of our own, so the callback only hears if it asked
+
+	anio->notifyOnWrite = anio->persistent;
+
+#if TARGET_OS_UNIXLIKE
+	AsyncIOSendFile *sendFile;
+
+	// the completion can start the next file, which then only has to wait for what was queued
+	//	ahead of it (not what's been written after)
+	while ( ( sendFile = anio->sendFile ) != NULL )
+	{
+		gated = true;
+		stream = anio->stream;
+
+		if ( sendFile->queuedAhead > 0 )
+		{
+			size_t flushed = AsyncIO_FlushOutput( anio, sendFile->queuedAhead );
+			sendFile->queuedAhead = ( stream->output.count > 0 ) ? sendFile->queuedAhead - flushed : 0;
+
+			if ( sendFile->queuedAhead > 0 )
+				goto rearm;
+		}
+
+		if ( !AsyncIO_PumpSendFile( anio ) )
+		{
+#if ASYNC_NETIO_USE_KQUEUE || ASYNC_NETIO_USE_EPOLL
+			// stopped at the burst with the socket still taking it, which a persistent connection
+			//	won't be told about again -- if there's no posting, it just carries on now
+			if ( anio->persistent && !sendFile->full && ( AsyncIO_PostSendFileResume( anio ) != 0 ) )
+				continue;
+#endif
+			goto rearm;
+		}
+
+		// the completion may have released it
+		if ( anio->loop->inProgress != anio )
+			return;
+	}
+
+	stream = anio->stream;
+#endif
+
+	if ( stream != NULL )
+	{
+		AsyncIO_FlushOutput( anio, stream->output.count );
+
+		if ( stream->output.count > 0 )
+		{
+			goto rearm;
+		}
+	}
+
+#if !ASYNC_NETIO_USE_SELECT
+	if ( anio->datagram != NULL )
+	{
+		// it re-arms itself if the kernel still won't take them
+		AsyncIO_SendQueuedDatagrams( anio );
+		if ( anio->datagram->txCount > 0 )
+			return;
+
+		gated = true;
+	}
+#endif
+
+	if ( gated && !anio->writeRequested )
+	{
+		return;
+	}
+
+	anio->writeRequested = false;
+	AsyncIO_CallBack( anio, kAIO_READY_FOR_WRITE, ident );
+	return;
+
+rearm:
+
+	if ( !anio->notifyOnWrite )
+	{
+		AsyncIO_ArmWritability( anio );
+	}
+}
+
+int				AsyncIO_SetStreamBuffers( AsyncIO anio, size_t inputSize, size_t outputSize )
+{
+	int result = -1;
+	AsyncIOStream *stream;
+
+	require( anio != NULL, exit );
+	require( anio->type == kAIO_TYPE_CONNECTION, exit );
+	require( ( inputSize > 0 ) && ( outputSize > 0 ), exit );
+
+	stream = AsyncIO_GetStream( anio );
+	require( stream != NULL, exit );
+
+	// only while they're empty
+	require( AsyncIO_RingResize( &stream->input, inputSize ) == 0, exit );
+	require( AsyncIO_RingResize( &stream->output, outputSize ) == 0, exit );
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+ssize_t			AsyncIO_Read( AsyncIO anio, void *buffer, size_t length )
+{
+	ssize_t result = -1;
+	AsyncIOStream *stream;
+	struct iovec iov[3];
+	ssize_t amount;
+	size_t copied;
+	int num;
+
+	require_action( anio != NULL, exit, errno = EINVAL );
+	require_action( anio->type == kAIO_TYPE_CONNECTION, exit, errno = EINVAL );
+#if ASYNC_NETIO_USE_IO_URING
+	require_action( !anio->completionReads, exit, errno = EBUSY );
+#endif
+
+	stream = AsyncIO_GetStream( anio );
+	require_action( stream != NULL, exit, errno = ENOMEM );
+
+	copied = AsyncIO_RingCopyOut( &stream->input, buffer, length );
+	if ( ( copied == length ) || stream->inputEOF )
+	{
+		result = copied;
+		goto exit;
+	}
+
+	// the caller's buffer gets filled directly, and only what doesn't fit lands in the ring
+	iov[0].iov_base = (uint8_t*)buffer + copied;
+	iov[0].iov_len = length - copied;
+	num = 1 + AsyncIO_RingFreeSpans( &stream->input, &iov[1] );
+
+	amount = readv( anio->fd, iov, num );
+	if ( amount < 0 )
+	{
+		// a failure will still be there next time
+		if ( copied > 0 )
+			result = copied;
+		goto exit;
+	}
+
+	if ( amount == 0 )
+	{
+		stream->inputEOF = true;
+	}
+	else if ( (size_t)amount > iov[0].iov_len )
+	{
+		stream->input.count += amount - iov[0].iov_len;
+		amount = iov[0].iov_len;
+	}
+
+	result = copied + amount;
+
+exit:
+
+	return result;
+}
+
+ssize_t			AsyncIO_WriteVector( AsyncIO anio, const struct iovec *iov, int count )
+{
+	ssize_t result = -1;
+	AsyncIOStream *stream;
+	ssize_t written = 0;
+	size_t accepted = 0;
+	int i;
+
+	require_action( anio != NULL, exit, errno = EINVAL );
+	require_action( anio->type == kAIO_TYPE_CONNECTION, exit, errno = EINVAL );
+	require_action( ( iov != NULL ) && ( count > 0 ), exit, errno = EINVAL );
+
+	stream = AsyncIO_GetStream( anio );
+	require_action( stream != NULL, exit, errno = ENOMEM );
+	require_action_quiet( stream->outputError == 0, exit, errno = stream->outputError );
+
+	// if there's a queue, the socket was full the last time we tried and writability is armed --
+	//	so don't bother the kernel, just get in line (and behind a file that's going out)
+	if ( ( stream->output.count == 0 ) && !AsyncIO_SendingFile( anio ) )
+	{
+		written = writev( anio->fd, iov, count );
+		if ( written < 0 )
+		{
+			require_action_quiet( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) || ( errno == EINTR ), exit, stream->outputError = errno );
+			written = 0;
+		}
+	}
+
+	// skip what went, queue what didn't (as much as fits)
+	for ( i = 0; i < count; i++ )
+	{
+		size_t length = iov[i].iov_len;
+
+		if ( (size_t)written >= length )
+		{
+			written -= length;
+			accepted += length;
+			continue;
+		}
+
+		size_t remaining = length - written;
+		size_t queued = AsyncIO_RingCopyIn( &stream->output, (const uint8_t*)iov[i].iov_base + written, remaining );
+		accepted += written + queued;
+		written = 0;
+
+		if ( queued < remaining )
+			break;
+	}
+
+	if ( ( stream->output.count > 0 ) && !anio->notifyOnWrite )
+	{
+		AsyncIO_ArmWritability( anio );
+	}
+
+	require_action_quiet( accepted > 0, exit, errno = EWOULDBLOCK );
+	result = accepted;
+
+exit:
+
+	return result;
+}
+
+ssize_t			AsyncIO_Write( AsyncIO anio, const void *data, size_t length )
+{
+	struct iovec iov;
+
+	if ( length == 0 )
+		return 0;
+
+	iov.iov_base = (void*)data;
+	iov.iov_len = length;
+
+	return AsyncIO_WriteVector( anio, &iov, 1 );
+}
+
+size_t			AsyncIO_GetQueuedOutput( AsyncIO anio )
+{
+	return ( ( anio != NULL ) && ( anio->stream != NULL ) ) ? anio->stream->output.count : 0;
+}
+
+#if TARGET_OS_UNIXLIKE
+int				AsyncIO_SendFile( AsyncIO anio, int fd, off_t offset, size_t length, AsyncIOSendFileCompletion completion, void * userData )
+{
+	int result = -1;
+	AsyncIOSendFile *sendFile = NULL;
+
+	require_action( anio != NULL, exit, errno = EINVAL );
+	require_action( anio->type == kAIO_TYPE_CONNECTION, exit, errno = EINVAL );
+	require_action( ( fd >= 0 ) && ( offset >= 0 ) && ( completion != NULL ), exit, errno = EINVAL );
+	require_action( anio->sendFile == NULL, exit, errno = EBUSY );
+#if !TARGET_OS_LINUX && !__APPLE__
+	require_action( 0, exit, errno = ENOTSUP );
+#endif
+
+	// 0 means the rest of the file
+	if ( length == 0 )
+	{
+		struct stat sb;
+
+		require( fstat( fd, &sb ) == 0, exit );
+		require_action( sb.st_size >= offset, exit, errno = EINVAL );
+		length = sb.st_size - offset;
+	}
+
+	sendFile = calloc( 1, sizeof( AsyncIOSendFile ) );
+	require_action( sendFile != NULL, exit, errno = ENOMEM );
+
+	sendFile->fd = fd;
+	sendFile->offset = offset;
+	sendFile->remaining = length;
+	sendFile->completion = completion;
+	sendFile->userData = userData;
+	sendFile->queuedAhead = ( anio->stream != NULL ) ? anio->stream->output.count : 0;
+
+	anio->sendFile = sendFile;
+
+	// it all happens from the loop, starting with the next writability -- so the completion is
+	//	never called from in here
+	if ( !anio->notifyOnWrite )
+	{
+		require( AsyncIO_ArmWritability( anio ) == 0, exit );
+	}
+#if ASYNC_NETIO_USE_KQUEUE || ASYNC_NETIO_USE_EPOLL
+	else if ( anio->persistent )
+	{
+		// already armed, and it won't hear again until the socket fills -- which nothing is doing
+		require( AsyncIO_PostSendFileResume( anio ) == 0, exit );
+	}
+#endif
+
+	result = 0;
+
+exit:
+
+	if ( ( result != 0 ) && ( anio != NULL ) && ( sendFile != NULL ) )
+	{
+		anio->sendFile = NULL;
+		ForgetMem( &sendFile );
+	}
+
+	return result;
+}
+#endif
+
+#if !ASYNC_NETIO_USE_SELECT
+
+static void	AsyncIO_SetupDatagramSlots( AsyncIOMsgHdr *headers, struct iovec *vectors, uint8_t *buffers, struct sockaddr_storage *addresses, int count, size_t maxPacket )
+{
+	int i;
+
+	for ( i = 0; i < count; i++ )
+	{
+		vectors[i].iov_base = buffers + ( i * maxPacket );
+		vectors[i].iov_len = maxPacket;
+
+		headers[i].msg_hdr.msg_iov = &vectors[i];
+		headers[i].msg_hdr.msg_iovlen = 1;
+		headers[i].msg_hdr.msg_name = &addresses[i];
+		headers[i].msg_hdr.msg_namelen = sizeof( struct sockaddr_storage );
+	}
+}
+
+static void	AsyncIO_ForgetDatagram( AsyncIO anio )
+{
+	AsyncIODatagramSocket *dgram = anio->datagram;
+	AsyncIO *link;
+
+	require_quiet( dgram != NULL, exit );
+
+	if ( dgram->pending )
+	{
+		for ( link = &anio->loop->datagramsPending; (*link) != NULL; link = &(*link)->datagram->nextPending )
+		{
+			if ( (*link) == anio )
+			{
+				(*link) = dgram->nextPending;
+				break;
+			}
+		}
+	}
+
+	ForgetMem( &dgram->rxBuffers );
+	ForgetMem( &dgram->rxHeaders );
+	ForgetMem( &dgram->rxVectors );
+	ForgetMem( &dgram->rxAddresses );
+	ForgetMem( &dgram->received );
+	ForgetMem( &dgram->txBuffers );
+	ForgetMem( &dgram->txHeaders );
+	ForgetMem( &dgram->txVectors );
+	ForgetMem( &dgram->txAddresses );
+	ForgetMem( &anio->datagram );
+
+exit:
+
+	return;
+}
+
+AsyncIO		AsyncIO_NewDatagramSocket( int fd, size_t maxPacket, int batchSize, AsyncIOEvent eventCallback, void * userData )
+{
+	struct OpaqueAsyncIO *anio = NULL, *result = NULL;
+	AsyncIODatagramSocket *dgram;
+	int flags, err;
+
+	require( ( maxPacket > 0 ) && ( batchSize > 0 ), exit );
+
+	anio = AsyncIO_NewObject( AsyncIO_CurrentLoop(), fd, kAIO_TYPE_DATAGRAM, eventCallback, userData );
+	require( anio != NULL, exit );
+
+	flags = fcntl( fd, F_GETFL, 0 );
+	require( flags != -1, exit );
+	err = fcntl( fd, F_SETFL, flags | O_NONBLOCK );
+	require( err == 0, exit );
+
+	// everything up front, so nothing gets allocated per packet
+	dgram = calloc( 1, sizeof( AsyncIODatagramSocket ) );
+	require( dgram != NULL, exit );
+	anio->datagram = dgram;
+
+	dgram->maxPacket = maxPacket;
+	dgram->batchSize = batchSize;
+
+	dgram->rxBuffers = malloc( batchSize * maxPacket );
+	dgram->rxHeaders = calloc( batchSize, sizeof( AsyncIOMsgHdr ) );
+	dgram->rxVectors = calloc( batchSize, sizeof( struct iovec ) );
+	dgram->rxAddresses = calloc( batchSize, sizeof( struct sockaddr_storage ) );
+	dgram->received = calloc( batchSize, sizeof( AsyncIODatagram ) );
+	dgram->txBuffers = malloc( batchSize * maxPacket );
+	dgram->txHeaders = calloc( batchSize, sizeof( AsyncIOMsgHdr ) );
+	dgram->txVectors = calloc( batchSize, sizeof( struct iovec ) );
+	dgram->txAddresses = calloc( batchSize, sizeof( struct sockaddr_storage ) );
+	require( ( dgram->rxBuffers != NULL ) && ( dgram->rxHeaders != NULL ) && ( dgram->rxVectors != NULL ) &&
+		( dgram->rxAddresses != NULL ) && ( dgram->received != NULL ) && ( dgram->txBuffers != NULL ) &&
+		( dgram->txHeaders != NULL ) && ( dgram->txVectors != NULL ) && ( dgram->txAddresses != NULL ), exit );
+
+	AsyncIO_SetupDatagramSlots( dgram->rxHeaders, dgram->rxVectors, dgram->rxBuffers, dgram->rxAddresses, batchSize, maxPacket );
+	AsyncIO_SetupDatagramSlots( dgram->txHeaders, dgram->txVectors, dgram->txBuffers, dgram->txAddresses, batchSize, maxPacket );
+
+	// watched for reads from the start, and it stays that way (level-triggered) until it's released
+#if ASYNC_NETIO_USE_KQUEUE
+	AsyncIO_QueueChange( anio, EVFILT_READ, EV_ADD );
+#endif
+	anio->notifyOnRead = true;
+#if ASYNC_NETIO_USE_EPOLL
+	err = AsyncIO_UpdateEpollRegistration( anio );
+	require( err == 0, exit );
+#endif
+#if ASYNC_NETIO_USE_POLL
+	err = AsyncIO_UpdatePollRegistration( anio );
+	require( err == 0, exit );
+#endif
+
+	ASYNC_NETIO_PRIME_RUN_LOOP();
+	result = anio;
+	anio = NULL;
+
+exit:
+
+	if ( anio != NULL )
+	{
+		anio->notifyOnRead = false;
+		AsyncIO_ForgetDatagram( anio );
+		ForgetAsyncIOObject( &anio );
+	}
+
+	return result;
+}
+
+// batches until the socket's empty (or we've had our share of this wakeup)
+static void	AsyncIO_ReceiveDatagrams( AsyncIO anio )
+{
+	AsyncIOLoop loop = anio->loop;
+	AsyncIODatagramSocket *dgram = anio->datagram;
+	int batches, num, i;
+
+	for ( batches = 0; ( batches < kAsyncIODatagramBatchesPerWakeup ) && ( loop->inProgress == anio ); batches++ )
+	{
+		for ( i = 0; i < dgram->batchSize; i++ )
+		{
+			dgram->rxHeaders[i].msg_hdr.msg_namelen = sizeof( struct sockaddr_storage );
+		}
+
+#if ASYNC_NETIO_USE_MMSG
+		num = recvmmsg( anio->fd, dgram->rxHeaders, dgram->batchSize, 0, NULL );
+#else
+		for ( num = 0; num < dgram->batchSize; num++ )
+		{
+			ssize_t length = recvmsg( anio->fd, &dgram->rxHeaders[num].msg_hdr, 0 );
+			if ( length < 0 )
+				break;
+			dgram->rxHeaders[num].msg_len = (unsigned int)length;
+		}
+		if ( num == 0 )
+			num = -1;
+#endif
+		if ( num < 0 )
+		{
+			if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+				break;
+
+			// (an ICMP error from an earlier send, usually -- reading it clears it)
+			dlog( kDebugLevelTrace, "AsyncIO: datagram receive on %d error %d\n", anio->fd, errno );
+			continue;
+		}
+
+		for ( i = 0; i < num; i++ )
+		{
+			dgram->received[i].data = dgram->rxVectors[i].iov_base;
+			dgram->received[i].length = dgram->rxHeaders[i].msg_len;
+			dgram->received[i].truncated = ( dgram->rxHeaders[i].msg_hdr.msg_flags & MSG_TRUNC ) != 0;
+			dgram->received[i].from = (const struct sockaddr *)&dgram->rxAddresses[i];
+			dgram->received[i].fromLength = dgram->rxHeaders[i].msg_hdr.msg_namelen;
+		}
+
+		dgram->numReceived = num;
+		AsyncIO_CallBack( anio, kAIO_DATAGRAMS_RECEIVED, anio->fd );
+
+		// released from the callback
+		if ( loop->inProgress != anio )
+			break;
+
+		dgram->numReceived = 0;
+
+		if ( num < dgram->batchSize )
+			break;
+	}
+}
+
+int				AsyncIO_GetReceivedDatagrams( AsyncIO anio, const AsyncIODatagram **outDatagrams )
+{
+	int result = -1;
+
+	require( anio != NULL, exit );
+	require( anio->datagram != NULL, exit );
+	require( outDatagrams != NULL, exit );
+
+	*outDatagrams = anio->datagram->received;
+	result = anio->datagram->numReceived;
+
+exit:
+
+	return result;
+}
+
+// as much of the ring as the kernel will take -- it's oldest first, so a wrapped ring takes two goes
+static void	AsyncIO_SendQueuedDatagrams( AsyncIO anio )
+{
+	AsyncIODatagramSocket *dgram = anio->datagram;
+	int count, num;
+
+	while ( dgram->txCount > 0 )
+	{
+		count = Minimum( dgram->txCount, dgram->batchSize - dgram->txHead );
+
+#if ASYNC_NETIO_USE_MMSG
+		num = sendmmsg( anio->fd, &dgram->txHeaders[dgram->txHead], count, 0 );
+#else
+		for ( num = 0; num < count; num++ )
+		{
+			if ( sendmsg( anio->fd, &dgram->txHeaders[dgram->txHead + num].msg_hdr, 0 ) < 0 )
+				break;
+		}
+		if ( num == 0 )
+			num = -1;
+#endif
+		if ( num < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+
+			if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+			{
+				if ( !anio->notifyOnWrite )
+				{
+					AsyncIO_ArmWritability( anio );
+				}
+				break;
+			}
+
+			// that one isn't going anywhere -- drop it, like the network would
+			dlog( kDebugLevelTrace, "AsyncIO: datagram send on %d error %d\n", anio->fd, errno );
+			num = 1;
+		}
+
+		dgram->txHead = ( dgram->txHead + num ) % dgram->batchSize;
+		dgram->txCount -= num;
+	}
+}
+
+// everything that was queued since the last pass goes out before the loop waits again
+static void	AsyncIO_FlushDatagramSends( AsyncIOLoop loop )
+{
+	AsyncIO anio;
+
+	while ( ( anio = loop->datagramsPending ) != NULL )
+	{
+		loop->datagramsPending = anio->datagram->nextPending;
+		anio->datagram->nextPending = NULL;
+		anio->datagram->pending = false;
+
+		AsyncIO_SendQueuedDatagrams( anio );
+	}
+}
+
+int				AsyncIO_SendDatagram( AsyncIO anio, const void *data, size_t length, const struct sockaddr *to, socklen_t toLength )
+{
+	int result = -1;
+	AsyncIODatagramSocket *dgram;
+	struct msghdr *header;
+	int slot;
+
+	require_action( ( anio != NULL ) && ( anio->datagram != NULL ), exit, errno = EINVAL );
+	require_action( ( data != NULL ) || ( length == 0 ), exit, errno = EINVAL );
+	require_action( ( to == NULL ) || ( toLength <= sizeof( struct sockaddr_storage ) ), exit, errno = EINVAL );
+
+	dgram = anio->datagram;
+	require_action( length <= dgram->maxPacket, exit, errno = EMSGSIZE );
+
+	// make room if we can
+	if ( dgram->txCount == dgram->batchSize )
+	{
+		AsyncIO_SendQueuedDatagrams( anio );
+	}
+	require_action_quiet( dgram->txCount < dgram->batchSize, exit, errno = EWOULDBLOCK );
+
+	slot = ( dgram->txHead + dgram->txCount ) % dgram->batchSize;
+	header = &dgram->txHeaders[slot].msg_hdr;
+
+	memcpy( dgram->txVectors[slot].iov_base, data, length );
+	dgram->txVectors[slot].iov_len = length;
+
+	if ( to != NULL )
+	{
+		memcpy( &dgram->txAddresses[slot], to, toLength );
+		header->msg_name = &dgram->txAddresses[slot];
+		header->msg_namelen = toLength;
+	}
+	else
+	{
+		header->msg_name = NULL;
+		header->msg_namelen = 0;
+	}
+
+	dgram->txCount++;
+
+	// if it's waiting for writability, that's when they'll go
+	if ( !dgram->pending && !anio->notifyOnWrite )
+	{
+		dgram->nextPending = anio->loop->datagramsPending;
+		anio->loop->datagramsPending = anio;
+		dgram->pending = true;
+	}
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIO_FlushDatagrams( AsyncIO anio )
+{
+	int result = -1;
+
+	require_action( ( anio != NULL ) && ( anio->datagram != NULL ), exit, errno = EINVAL );
+
+	AsyncIO_SendQueuedDatagrams( anio );
+	require_action_quiet( anio->datagram->txCount == 0, exit, errno = EWOULDBLOCK );
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+#endif
+
+#if ASYNC_NETIO_USE_IO_URING
+
+// completion mode -- rather than waiting for readability and then calling read(), a read is
+//	left outstanding in one of the ring's buffers, and the kernel tells us when it's done.
+//	the ring's own descriptor is registered with epoll, so completions wake up the same
+//	epoll_wait() everything else uses, and new submissions are only handed to the kernel
+//	right before we wait (one io_uring_enter() for the whole pass through the loop)
+
+#ifndef kAIOURingEntries
+#define kAIOURingEntries			256
+#endif
+
+#ifndef kAIOURingBufferCount
+#define kAIOURingBufferCount		64
+#endif
+
+#ifndef kAIOURingBufferSize
+#define kAIOURingBufferSize			16384
+#endif
+
+#define kAIOURingNoOp				0				// op numbers start at 1, so zeroed memory means "none"
+#define kAIOURingCancelUserData		UINT64_MAX
+#define kAIOURingOpTag				( 1ULL << 63 )	// on a ring op's user_data -- file ops use the pointer
+
+#define kAIOURingOpFree				0
+#define kAIOURingOpRead				1
+#define kAIOURingOpWrite			2
+
+typedef struct
+{
+	AsyncIO		anio;			// NULL once the AsyncIO has been released
+	int			kind;
+	int			next;			// next queued write
+	uint32_t	offset;			// how much of a write has completed
+	uint32_t	length;
+	uint32_t	generation;		// bumped each time the number is handed out
+	bool		cancelPending;	// released, but there wasn't an sqe for the cancel yet
+} AsyncIOURingOp;
+
+struct AsyncIOURing
+{
+	int						fd;
+	AsyncIO					anio;			// how we hear about completions from epoll
+	bool					buffersRegistered;
+
+	void*					sqRing;
+	size_t					sqRingSize;
+	void*					cqRing;
+	size_t					cqRingSize;
+	struct io_uring_sqe*	sqes;
+	size_t					sqesSize;
+
+	unsigned*				sqHead;
+	unsigned*				sqTail;
+	unsigned*				sqMask;
+	unsigned*				sqArray;
+	unsigned				toSubmit;
+
+	unsigned*				cqHead;
+	unsigned*				cqTail;
+	unsigned*				cqMask;
+	struct io_uring_cqe*	cqes;
+
+	uint8_t*				buffers;
+	AsyncIOURingOp			ops[ kAIOURingBufferCount + 1 ];	// op N uses buffer N-1
+	int						freeOps[ kAIOURingBufferCount ];
+	int						numFreeOps;
+	int						numCancelsPending;
+};
+
+// once one loop finds the kernel can't do it, the others (on other threads) don't bother trying
+static bool		anioURingUnavailable = false;
+
+#define AsyncIO_URingBuffer( op )		( &loop->uring->buffers[ ( (op) - 1 ) * kAIOURingBufferSize ] )
+
+// the number alone could already belong to the next op by the time the kernel sees a cancel for it
+#define AsyncIO_URingUserData( op )		( kAIOURingOpTag | ( (uint64_t)loop->uring->ops[ (op) ].generation << 32 ) | (uint64_t)(op) )
+
+static void AsyncIO_URingDispose( AsyncIOURing *ring )
+{
+	if ( ring->anio != NULL )
+	{
+		// the ring's descriptor is closed below
+		AsyncIO_Release( ring->anio, false );
+	}
+	if ( ( ring->cqRing != NULL ) && ( ring->cqRing != ring->sqRing ) ) { munmap( ring->cqRing, ring->cqRingSize ); }
+	if ( ring->sqRing != NULL ) { munmap( ring->sqRing, ring->sqRingSize ); }
+	if ( ring->sqes != NULL ) { munmap( ring->sqes, ring->sqesSize ); }
+	ForgetFD( &ring->fd );
+	ForgetMem( &ring->buffers );
+	ForgetMem( &ring );
+}
+
+static int AsyncIO_URingInitialize( AsyncIOLoop loop )
+{
+	int result = -1;
+	AsyncIOURing *ring = NULL;
+	struct io_uring_params params;
+	int err, i;
+
+	require_action_quiet( loop->uring == NULL, exit, result = 0 );
+	require_action_quiet( !__atomic_load_n( &anioURingUnavailable, __ATOMIC_RELAXED ), exit, errno = ENOTSUP );
+
+	ring = calloc( 1, sizeof( AsyncIOURing ) );
+	require( ring != NULL, exit );
+
+	memset( &params, 0, sizeof( params ) );
+	ring->fd = (int)syscall( __NR_io_uring_setup, kAIOURingEntries, &params );
+	if ( ring->fd < 0 ) { dlog( kDebugLevelTrace, "AsyncIO: io_uring not available (%d)\n", errno ); }
+
+	// only for good when the kernel doesn't do it (or won't let us) -- running out of locked
+	//	memory or descriptors just fails this one, and the next loop can try again
+	if ( ( ring->fd < 0 ) && ( ( errno == ENOSYS ) || ( errno == EPERM ) || ( errno == EINVAL ) ) )
+	{
+		__atomic_store_n( &anioURingUnavailable, true, __ATOMIC_RELAXED );
+		errno = ENOTSUP;
+	}
+	require_quiet( ring->fd >= 0, exit );
+
+	ring->sqRingSize = params.sq_off.array + ( params.sq_entries * sizeof( unsigned ) );
+	ring->cqRingSize = params.cq_off.cqes + ( params.cq_entries * sizeof( struct io_uring_cqe ) );
+	if ( params.features & IORING_FEAT_SINGLE_MMAP )
+	{
+		ring->sqRingSize = Maximum( ring->sqRingSize, ring->cqRingSize );
+	}
+
+	ring->sqRing = mmap( NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING );
+	require_action( ring->sqRing != MAP_FAILED, exit, ring->sqRing = NULL );
+
+	if ( params.features & IORING_FEAT_SINGLE_MMAP )
+	{
+		ring->cqRing = ring->sqRing;
+	}
+	else
+	{
+		ring->cqRing = mmap( NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING );
+		require_action( ring->cqRing != MAP_FAILED, exit, ring->cqRing = NULL );
+	}
+
+	ring->sqesSize = params.sq_entries * sizeof( struct io_uring_sqe );
+	ring->sqes = mmap( NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES );
+	require_action( ring->sqes != MAP_FAILED, exit, ring->sqes = NULL );
+
+	ring->sqHead = (unsigned*)( (uint8_t*)ring->sqRing + params.sq_off.head );
+	ring->sqTail = (unsigned*)( (uint8_t*)ring->sqRing + params.sq_off.tail );
+	ring->sqMask = (unsigned*)( (uint8_t*)ring->sqRing + params.sq_off.ring_mask );
+	ring->sqArray = (unsigned*)( (uint8_t*)ring->sqRing + params.sq_off.array );
+
+	ring->cqHead = (unsigned*)( (uint8_t*)ring->cqRing + params.cq_off.head );
+	ring->cqTail = (unsigned*)( (uint8_t*)ring->cqRing + params.cq_off.tail );
+	ring->cqMask = (unsigned*)( (uint8_t*)ring->cqRing + params.cq_off.ring_mask );
+	ring->cqes = (struct io_uring_cqe*)( (uint8_t*)ring->cqRing + params.cq_off.cqes );
+
+	err = posix_memalign( (void**)&ring->buffers, 4096, kAIOURingBufferCount * kAIOURingBufferSize );
+	require_action( err == 0, exit, ring->buffers = NULL );
+
+	// registering the buffers saves the kernel from mapping them on every operation, but it
+	//	counts against RLIMIT_MEMLOCK -- if we can't, the plain read/write opcodes still work
+	struct iovec iov;
+	iov.iov_base = ring->buffers;
+	iov.iov_len = kAIOURingBufferCount * kAIOURingBufferSize;
+	err = (int)syscall( __NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1 );
+	if ( err != 0 ) { dlog( kDebugLevelTrace, "AsyncIO: io_uring buffers not registered (%d)\n", errno ); }
+	ring->buffersRegistered = ( err == 0 );
+
+	for ( i = 0; i < kAIOURingBufferCount; i++ )
+	{
+		ring->freeOps[ ring->numFreeOps++ ] = kAIOURingBufferCount - i;
+	}
+
+	// completions make the ring's descriptor readable
+	ring->anio = AsyncIO_NewObject( loop, ring->fd, kAIO_TYPE_URING, NULL, NULL );
+	require( ring->anio != NULL, exit );
+
+	ring->anio->notifyOnRead = true;
+	err = AsyncIO_UpdateEpollRegistration( ring->anio );
+	require( err == 0, exit );
+
+	loop->uring = ring;
+	ring = NULL;
+	result = 0;
+
+exit:
+
+	if ( ring != NULL )
+	{
+		AsyncIO_URingDispose( ring );
+	}
+
+	return result;
+}
+
+static struct io_uring_sqe * AsyncIO_URingGetSQE( AsyncIOLoop loop )
+{
+	struct io_uring_sqe *result = NULL;
+	unsigned head, tail;
+
+	head = __atomic_load_n( loop->uring->sqHead, __ATOMIC_ACQUIRE );
+	tail = *loop->uring->sqTail;
+
+	if ( tail - head > *loop->uring->sqMask )
+	{
+		// full -- hand what we have to the kernel, and try again
+		AsyncIO_URingSubmit( loop );
+		head = __atomic_load_n( loop->uring->sqHead, __ATOMIC_ACQUIRE );
+	}
+	require_quiet( tail - head <= *loop->uring->sqMask, exit );
+
+	result = &loop->uring->sqes[ tail & *loop->uring->sqMask ];
+	memset( result, 0, sizeof( *result ) );
+	loop->uring->sqArray[ tail & *loop->uring->sqMask ] = tail & *loop->uring->sqMask;
+
+	// the kernel won't look at it until it's submitted
+	__atomic_store_n( loop->uring->sqTail, tail + 1, __ATOMIC_RELEASE );
+	loop->uring->toSubmit++;
+
+exit:
+
+	return result;
+}
+
+static void AsyncIO_URingQueuePendingCancels( AsyncIOLoop loop );
+
+static void AsyncIO_URingSubmit( AsyncIOLoop loop )
+{
+	int num;
+
+	require_quiet( loop->uring != NULL, exit );
+
+	// cancels that didn't get an sqe the first time go out with everything else
+	if ( loop->uring->numCancelsPending > 0 )
+	{
+		AsyncIO_URingQueuePendingCancels( loop );
+	}
+
+	require_quiet( loop->uring->toSubmit > 0, exit );
+
+	num = (int)syscall( __NR_io_uring_enter, loop->uring->fd, loop->uring->toSubmit, 0, 0, NULL, 0 );
+	if ( num < 0 ) { dlog( kDebugLevelError, "AsyncIO: io_uring_enter error %d\n", errno ); }
+	require_quiet( num >= 0, exit );
+
+	loop->uring->toSubmit -= Minimum( (unsigned)num, loop->uring->toSubmit );
+
+exit:
+	;
+}
+
+static int AsyncIO_URingQueueOp( AsyncIOLoop loop, int opNum )
+{
+	int result = -1;
+	AsyncIOURingOp *op = &loop->uring->ops[ opNum ];
+	struct io_uring_sqe *sqe;
+	bool fixed = loop->uring->buffersRegistered;
+
+	sqe = AsyncIO_URingGetSQE( loop );
+	require( sqe != NULL, exit );
+
+	if ( op->kind == kAIOURingOpRead )
+	{
+		sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+		sqe->addr = (uint64_t)(uintptr_t)AsyncIO_URingBuffer( opNum );
+		sqe->len = kAIOURingBufferSize;
+	}
+	else
+	{
+		sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+		sqe->addr = (uint64_t)(uintptr_t)( AsyncIO_URingBuffer( opNum ) + op->offset );
+		sqe->len = op->length - op->offset;
+	}
+
+	// sockets and pipes ignore the offset, -1 means "current position" for anything else
+	sqe->fd = op->anio->fd;
+	sqe->off = (uint64_t)-1;
+	sqe->buf_index = 0;
+	sqe->user_data = AsyncIO_URingUserData( opNum );
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+static int AsyncIO_URingAllocateOp( AsyncIOLoop loop, AsyncIO anio, int kind )
+{
+	int result = kAIOURingNoOp;
+	uint32_t generation;
+
+	require_action_quiet( loop->uring->numFreeOps > 0, exit, errno = EAGAIN );
+
+	result = loop->uring->freeOps[ --loop->uring->numFreeOps ];
+	generation = loop->uring->ops[ result ].generation + 1;
+	memset( &loop->uring->ops[ result ], 0, sizeof( AsyncIOURingOp ) );
+	loop->uring->ops[ result ].anio = anio;
+	loop->uring->ops[ result ].kind = kind;
+	loop->uring->ops[ result ].generation = generation & 0x7FFFFFFF;
+
+exit:
+
+	return result;
+}
+
+static void AsyncIO_URingFreeOp( AsyncIOLoop loop, int opNum )
+{
+	// it finished on its own, so there's nothing left to cancel
+	if ( loop->uring->ops[ opNum ].cancelPending )
+	{
+		loop->uring->ops[ opNum ].cancelPending = false;
+		loop->uring->numCancelsPending--;
+	}
+
+	loop->uring->ops[ opNum ].kind = kAIOURingOpFree;
+	loop->uring->ops[ opNum ].anio = NULL;
+	loop->uring->freeOps[ loop->uring->numFreeOps++ ] = opNum;
+}
+
+static int AsyncIO_URingQueueCancel( AsyncIOLoop loop, int opNum )
+{
+	int result = -1;
+	struct io_uring_sqe *sqe;
+
+	sqe = AsyncIO_URingGetSQE( loop );
+	require_quiet( sqe != NULL, exit );
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = AsyncIO_URingUserData( opNum );
+	sqe->user_data = kAIOURingCancelUserData;
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+static void AsyncIO_URingCancelOp( AsyncIOLoop loop, int opNum )
+{
+	// the op stays allocated until its own completion shows up
+	loop->uring->ops[ opNum ].anio = NULL;
+
+	// if there's no sqe for it now, the next submit tries again -- a read left alone would sit in
+	//	the kernel, holding its buffer, until the peer sends something
+	if ( ( AsyncIO_URingQueueCancel( loop, opNum ) != 0 ) && !loop->uring->ops[ opNum ].cancelPending )
+	{
+		loop->uring->ops[ opNum ].cancelPending = true;
+		loop->uring->numCancelsPending++;
+	}
+}
+
+// only into free sqes -- this runs on the way into AsyncIO_URingSubmit(), which a full queue calls
+static void AsyncIO_URingQueuePendingCancels( AsyncIOLoop loop )
+{
+	unsigned head, tail;
+	int opNum;
+
+	for ( opNum = 1; ( opNum <= kAIOURingBufferCount ) && ( loop->uring->numCancelsPending > 0 ); opNum++ )
+	{
+		if ( !loop->uring->ops[ opNum ].cancelPending )
+			continue;
+
+		head = __atomic_load_n( loop->uring->sqHead, __ATOMIC_ACQUIRE );
+		tail = *loop->uring->sqTail;
+		if ( tail - head > *loop->uring->sqMask )
+			break;
+
+		if ( AsyncIO_URingQueueCancel( loop, opNum ) == 0 )
+		{
+			loop->uring->ops[ opNum ].cancelPending = false;
+			loop->uring->numCancelsPending--;
+		}
+	}
+}
+
+static void AsyncIO_URingRelease( AsyncIO anio )
+{
+	AsyncIOLoop loop = anio->loop;
+	int opNum, next;
+
+	require_quiet( anio->type == kAIO_TYPE_CONNECTION, exit );
+
+	anio->completionReads = false;
+
+	if ( anio->uringReadOp != kAIOURingNoOp )
+	{
+		AsyncIO_URingCancelOp( loop, anio->uringReadOp );
+		anio->uringReadOp = kAIOURingNoOp;
+	}
+
+	for ( opNum = anio->uringWriteHead; opNum != kAIOURingNoOp; opNum = next )
+	{
+		next = loop->uring->ops[ opNum ].next;
+
+		if ( opNum == anio->uringWriteHead )
+		{
+			// already in the kernel's hands
+			AsyncIO_URingCancelOp( loop, opNum );
+		}
+		else
+		{
+			AsyncIO_URingFreeOp( loop, opNum );
+		}
+	}
+	anio->uringWriteHead = kAIOURingNoOp;
+	anio->uringWriteTail = kAIOURingNoOp;
+
+exit:
+	;
+}
+
+static void AsyncIO_URingCompleteRead( AsyncIOLoop loop, int opNum, int res )
+{
+	AsyncIOURingOp *op = &loop->uring->ops[ opNum ];
+	AsyncIO anio = op->anio;
+
+	if ( anio == NULL )
+	{
+		// released (or cancelled) while it was in flight
+		AsyncIO_URingFreeOp( loop, opNum );
+	}
+	else if ( res > 0 )
+	{
+		anio->completedData = AsyncIO_URingBuffer( opNum );
+		anio->completedLength = (size_t)res;
+
+		loop->inProgress = anio;
+		AsyncIO_CallBack( anio, kAIO_READ_COMPLETED, anio->fd );
+
+		// the buffer goes right back to the kernel for the next read
+		if ( ( loop->inProgress == anio ) && ( anio->completionReads ) )
+		{
+			anio->completedData = NULL;
+			anio->completedLength = 0;
+			if ( AsyncIO_URingQueueOp( loop, opNum ) == 0 )
+			{
+				opNum = kAIOURingNoOp;
+			}
+		}
+
+		if ( opNum != kAIOURingNoOp )
+		{
+			if ( loop->inProgress == anio )
+			{
+				anio->completedData = NULL;
+				anio->completedLength = 0;
+				anio->uringReadOp = kAIOURingNoOp;
+			}
+			AsyncIO_URingFreeOp( loop, opNum );
+		}
+		loop->inProgress = NULL;
+	}
+	else
+	{
+		// zero means the other side closed, anything else is an error
+		anio->uringReadOp = kAIOURingNoOp;
+		anio->completionReads = false;
+		AsyncIO_URingFreeOp( loop, opNum );
+
+		if ( res < 0 ) { dlog( kDebugLevelTrace, "AsyncIO: io_uring read error %d\n", -res ); }
+		errno = ( res < 0 ) ? -res : 0;
+
+		loop->inProgress = anio;
+		AsyncIO_CallBack( anio, kAIO_CONNECTION_CLOSED, anio->fd );
+		loop->inProgress = NULL;
+	}
+}
+
+static void AsyncIO_URingCompleteWrite( AsyncIOLoop loop, int opNum, int res )
+{
+	AsyncIOURingOp *op = &loop->uring->ops[ opNum ];
+	AsyncIO anio = op->anio;
+	bool done = true;
+
+	if ( anio == NULL )
+	{
+		AsyncIO_URingFreeOp( loop, opNum );
+		done = false;
+	}
+	else if ( ( res > 0 ) && ( op->offset + (uint32_t)res < op->length ) )
+	{
+		// short write -- keep going with the rest of the buffer
+		op->offset += (uint32_t)res;
+		done = false;
+		if ( AsyncIO_URingQueueOp( loop, opNum ) != 0 )
+		{
+			res = -ENOBUFS;
+			done = true;
+		}
+	}
+
+	if ( done )
+	{
+		// start the next queued write before we tell them about this one
+		anio->uringWriteHead = op->next;
+		if ( anio->uringWriteHead == kAIOURingNoOp )
+		{
+			anio->uringWriteTail = kAIOURingNoOp;
+		}
+		else if ( res > 0 )
+		{
+			AsyncIO_URingQueueOp( loop, anio->uringWriteHead );
+		}
+		AsyncIO_URingFreeOp( loop, opNum );
+
+		loop->inProgress = anio;
+		if ( res > 0 )
+		{
+			AsyncIO_CallBack( anio, kAIO_WRITE_COMPLETED, anio->fd );
+		}
+		else
+		{
+			if ( res < 0 ) { dlog( kDebugLevelTrace, "AsyncIO: io_uring write error %d\n", -res ); }
+			errno = ( res < 0 ) ? -res : EPIPE;
+
+			// the rest of the queue isn't going anywhere
+			if ( anio->uringWriteHead != kAIOURingNoOp )
+			{
+				int next, queued;
+				for ( queued = anio->uringWriteHead; queued != kAIOURingNoOp; queued = next )
+				{
+					next = loop->uring->ops[ queued ].next;
+					AsyncIO_URingFreeOp( loop, queued );
+				}
+				anio->uringWriteHead = kAIOURingNoOp;
+				anio->uringWriteTail = kAIOURingNoOp;
+			}
+
+			AsyncIO_CallBack( anio, kAIO_CONNECTION_CLOSED, anio->fd );
+		}
+		loop->inProgress = NULL;
+	}
+}
+
+static void AsyncIO_URingReapCompletions( AsyncIOLoop loop )
+{
+	unsigned head, tail;
+	int opNum;
+
+	require_quiet( loop->uring != NULL, exit );
+
+	head = *loop->uring->cqHead;
+	while ( true )
+	{
+		tail = __atomic_load_n( loop->uring->cqTail, __ATOMIC_ACQUIRE );
+		if ( head == tail )
+			break;
+
+		struct io_uring_cqe *cqe = &loop->uring->cqes[ head & *loop->uring->cqMask ];
+		uint64_t user_data = cqe->user_data;
+		int res = cqe->res;
+
+		// give the slot back before the callbacks, they may submit more
+		head++;
+		__atomic_store_n( loop->uring->cqHead, head, __ATOMIC_RELEASE );
+
+		require_continue_quiet( user_data != kAIOURingCancelUserData );
+
+		// anything untagged is file I/O, and the user_data is the op itself
+		if ( ( user_data & kAIOURingOpTag ) == 0 )
+		{
+			AsyncIO_URingCompleteFileOp( loop, (AsyncIOFileOp*)(uintptr_t)user_data, res );
+			continue;
+		}
+
+		opNum = (int)( user_data & 0xFFFFFFFF );
+		require_continue( ( opNum > kAIOURingNoOp ) && ( opNum <= kAIOURingBufferCount ) );
+		require_continue( user_data == AsyncIO_URingUserData( opNum ) );
+
+		if ( loop->uring->ops[ opNum ].kind == kAIOURingOpRead )
+		{
+			AsyncIO_URingCompleteRead( loop, opNum, res );
+		}
+		else if ( loop->uring->ops[ opNum ].kind == kAIOURingOpWrite )
+		{
+			AsyncIO_URingCompleteWrite( loop, opNum, res );
+		}
+	}
+
+exit:
+	;
+}
+
+int				AsyncIO_StartCompletionReads( AsyncIO anio )
+{
+	int result = -1;
+	int err, opNum;
+
+	require( anio != NULL, exit );
+	require_action( anio->type == kAIO_TYPE_CONNECTION, exit, errno = EINVAL );
+
+	AsyncIOLoop loop = anio->loop;
+	err = AsyncIO_URingInitialize( loop );
+	require_quiet( err == 0, exit );
+
+	anio->completionReads = true;
+	require_action_quiet( anio->uringReadOp == kAIOURingNoOp, exit, result = 0 );
+
+	opNum = AsyncIO_URingAllocateOp( loop, anio, kAIOURingOpRead );
+	require_quiet( opNum != kAIOURingNoOp, exit );
+
+	err = AsyncIO_URingQueueOp( loop, opNum );
+	require_action( err == 0, exit, AsyncIO_URingFreeOp( loop, opNum ) );
+
+	anio->uringReadOp = opNum;
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIO_StopCompletionReads( AsyncIO anio )
+{
+	int result = -1;
+
+	require( anio != NULL, exit );
+
+	anio->completionReads = false;
+
+	// during the callback the buffer is ours, and it just won't be resubmitted
+	if ( ( anio->uringReadOp != kAIOURingNoOp ) && ( anio->completedData == NULL ) )
+	{
+		AsyncIO_URingCancelOp( anio->loop, anio->uringReadOp );
+		anio->uringReadOp = kAIOURingNoOp;
+	}
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIO_GetCompletedRead( AsyncIO anio, const void **outData, size_t *outLength )
+{
+	int result = -1;
+
+	require( ( anio != NULL ) && ( outData != NULL ) && ( outLength != NULL ), exit );
+	require( anio->completedData != NULL, exit );
+
+	*outData = anio->completedData;
+	*outLength = anio->completedLength;
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+ssize_t			AsyncIO_SubmitWrite( AsyncIO anio, const void *data, size_t length )
+{
+	ssize_t result = -1;
+	int err, opNum;
+
+	require( ( anio != NULL ) && ( data != NULL ), exit );
+	require_action( anio->type == kAIO_TYPE_CONNECTION, exit, errno = EINVAL );
+
+	AsyncIOLoop loop = anio->loop;
+	err = AsyncIO_URingInitialize( loop );
+	require_quiet( err == 0, exit );
+
+	opNum = AsyncIO_URingAllocateOp( loop, anio, kAIOURingOpWrite );
+	require_quiet( opNum != kAIOURingNoOp, exit );
+
+	AsyncIOURingOp *op = &loop->uring->ops[ opNum ];
+	op->length = (uint32_t)Minimum( length, (size_t)kAIOURingBufferSize );
+	memcpy( AsyncIO_URingBuffer( opNum ), data, op->length );
+
+	// writes to the same descriptor have to happen in order, so only one goes to the kernel at a time
+	if ( anio->uringWriteTail == kAIOURingNoOp )
+	{
+		err = AsyncIO_URingQueueOp( loop, opNum );
+		require_action( err == 0, exit, AsyncIO_URingFreeOp( loop, opNum ) );
+
+		anio->uringWriteHead = opNum;
+	}
+	else
+	{
+		loop->uring->ops[ anio->uringWriteTail ].next = opNum;
+	}
+	anio->uringWriteTail = opNum;
+
+	result = (ssize_t)op->length;
+
+exit:
+
+	return result;
+}
+
+#endif
+
+#if ASYNC_NETIO_USE_RUN_LOOP
+
+static void AsyncIO_PrimeRunLoop( void )
+{
+	// nobody waits on the kqueue with our changelist when the run loop is in charge
+	AsyncIO_FlushChanges( anioDefaultLoop );
+	AsyncIO_ArmKernelTimer( anioDefaultLoop );
+	CFFileDescriptorEnableCallBacks( anioDescriptorRef, kCFFileDescriptorReadCallBack );
+}
+
+static void AsyncIO_CFFileDescriptorCallBack( CFFileDescriptorRef f, CFOptionFlags callBackTypes, void *info )
+{
+	//dlog( kDebugLevelChatty, "AsyncIO_CFFileDescriptorCallBack: 0x%08lX\n", callBackTypes );
+	require( f == anioDescriptorRef, exit );
+	require( info == NULL, exit );
+	require( callBackTypes == kCFFileDescriptorReadCallBack, exit );
+
+	int err;
+	err = AsyncIOLoop_Run( anioDefaultLoop, 0 );
+	require( err == 0, exit );
+	
+	// re-enable read notification (and the timer for whatever is due next)
+	AsyncIO_PrimeRunLoop();
+	
+exit:
+	;
+}
+#endif
+
+
+
+#if !ASYNC_NETIO_USE_SELECT
+
+static int		AsyncIO_CreateWakeup( AsyncIOLoop loop )
+{
+	int result = -1;
+	int err, fds[2] = { kInvalidFD, kInvalidFD };
+
+#if ASYNC_NETIO_USE_EPOLL
+	fds[0] = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+	require( fds[0] >= 0, exit );
+	fds[1] = fds[0];
+#else
+	err = pipe( fds );
+	require( err == 0, exit );
+
+	fcntl( fds[0], F_SETFD, FD_CLOEXEC );
+	fcntl( fds[1], F_SETFD, FD_CLOEXEC );
+	err = fcntl( fds[1], F_SETFL, fcntl( fds[1], F_GETFL, 0 ) | O_NONBLOCK );
+	require( err == 0, exit );
+#endif
+
+	loop->wakeup = AsyncIO_NewObject( loop, fds[0], kAIO_TYPE_WAKEUP, NULL, NULL );
+	require( loop->wakeup != NULL, exit );
+
+	loop->wakeupWriteFD = fds[1];
+	fds[0] = fds[1] = kInvalidFD;
+
+	err = fcntl( loop->wakeup->fd, F_SETFL, fcntl( loop->wakeup->fd, F_GETFL, 0 ) | O_NONBLOCK );
+	require( err == 0, exit );
+
+	// stays registered for the life of the loop
+#if ASYNC_NETIO_USE_EPOLL
+	loop->wakeup->notifyOnRead = true;
+	err = AsyncIO_UpdateEpollRegistration( loop->wakeup );
+	require( err == 0, exit );
+#endif
+
+#if ASYNC_NETIO_USE_POLL
+	loop->wakeup->notifyOnRead = true;
+	err = AsyncIO_UpdatePollRegistration( loop->wakeup );
+	require( err == 0, exit );
+#endif
+
+#if ASYNC_NETIO_USE_KQUEUE
+#ifdef EV_SET64
+	struct kevent64_s	kv;
+	EV_SET64( &kv, loop->wakeup->fd, EVFILT_READ, EV_ADD, 0, 0, (uint64_t)AsyncIO_Handle( loop->wakeup ), 0, 0 );
+	err = kevent64( loop->kq, &kv, 1, NULL, 0, 0, NULL );
+#else
+	struct kevent	kv;
+	EV_SET( &kv, loop->wakeup->fd, EVFILT_READ, EV_ADD, 0, 0, (void*)AsyncIO_Handle( loop->wakeup ) );
+	err = kevent( loop->kq, &kv, 1, NULL, 0, NULL );
+#endif
+	require( err == 0, exit );
+#endif
+
+	result = 0;
+
+exit:
+
+	if ( fds[1] != fds[0] )
+	{
+		ForgetFD( &fds[1] );
+	}
+	ForgetFD( &fds[0] );
+
+	return result;
+}
+
+static void		AsyncIOLoop_Wakeup( AsyncIOLoop loop );
+
+static void		AsyncIO_PushTask( AsyncIOLoop loop, AsyncIOTask *task )
+{
+	AsyncIOTask *prev;
+
+	__atomic_store_n( &task->next, NULL, __ATOMIC_RELAXED );
+	prev = __atomic_exchange_n( &loop->postTail, task, __ATOMIC_ACQ_REL );
+
+	// between the exchange and this, the queue is briefly broken at prev -- see AsyncIO_PopTask()
+	__atomic_store_n( &prev->next, task, __ATOMIC_RELEASE );
+}
+
+// loop thread only
+static AsyncIOTask *	AsyncIO_PopTask( AsyncIOLoop loop )
+{
+	AsyncIOTask *head = loop->postHead;
+	AsyncIOTask *next = __atomic_load_n( &head->next, __ATOMIC_ACQUIRE );
+
+	if ( head == &loop->postStub )
+	{
+		if ( next == NULL )
+			return NULL;
+
+		loop->postHead = next;
+		head = next;
+		next = __atomic_load_n( &head->next, __ATOMIC_ACQUIRE );
+	}
+
+	if ( next == NULL )
+	{
+		// a producer is between its two steps -- it may have been preempted there, so rather than
+		//	wait on it, leave the rest for later: AsyncIO_RunPostedTasks() cleared the doorbell
+		//	before it started taking, so that producer rings again once it's done
+		if ( head != __atomic_load_n( &loop->postTail, __ATOMIC_ACQUIRE ) )
+			return NULL;
+
+		// head is the last one, so put the stub back behind it before taking it
+		AsyncIO_PushTask( loop, &loop->postStub );
+		next = __atomic_load_n( &head->next, __ATOMIC_ACQUIRE );
+
+		// (and another producer got in ahead of the stub)
+		if ( next == NULL )
+			return NULL;
+	}
+
+	loop->postHead = next;
+	return head;
+}
+
+static void		AsyncIO_RunPostedTasks( AsyncIOLoop loop )
+{
+	AsyncIOTask *task;
+	int num = 0;
+
+	// reset before looking, so anything posted from here on rings again
+	__atomic_store_n( &loop->postDoorbell, 0, __ATOMIC_SEQ_CST );
+
+	while ( ( task = AsyncIO_PopTask( loop ) ) != NULL )
+	{
+		(*(task->function))( task->context );
+		ForgetMem( &task );
+
+		if ( ++num >= kAsyncIOMaxTasksPerPass )
+		{
+			// come back for the rest after the descriptors have had a turn
+			__atomic_store_n( &loop->postDoorbell, 1, __ATOMIC_SEQ_CST );
+			AsyncIOLoop_Wakeup( loop );
+			break;
+		}
+	}
+}
+
+static void		AsyncIO_DrainWakeup( AsyncIO anio )
+{
+	uint8_t buffer[64];
+
+	while ( read( anio->fd, buffer, sizeof( buffer ) ) > 0 )
+		;
+
+	AsyncIO_RunPostedTasks( anio->loop );
+}
+
+// safe to call from any thread
+static void		AsyncIOLoop_Wakeup( AsyncIOLoop loop )
+{
+	ssize_t num;
+
+	require_quiet( loop->wakeupWriteFD >= 0, exit );
+
+#if ASYNC_NETIO_USE_EPOLL
+	uint64_t one = 1;
+	num = write( loop->wakeupWriteFD, &one, sizeof( one ) );
+#else
+	uint8_t one = 1;
+	num = write( loop->wakeupWriteFD, &one, sizeof( one ) );
+#endif
+
+	// a full pipe (or counter) is already going to wake the loop
+	if ( ( num < 0 ) && ( errno != EAGAIN ) ) { dlog( kDebugLevelError, "AsyncIO: wakeup write error %d\n", errno ); }
+
+exit:
+	;
+}
+
+// offloaded work that hasn't come back would post to a loop that's gone -- so wait for it, running
+//	the completions as they arrive (nothing else on the loop gets a turn)
+static int		AsyncIO_DrainOffloads( AsyncIOLoop loop )
+{
+	int result = -1;
+	struct pollfd pfd[2];
+	nfds_t count;
+	int err;
+
+	while ( __atomic_load_n( &loop->offloadsPending, __ATOMIC_ACQUIRE ) > 0 )
+	{
+		require( loop->wakeup != NULL, exit );
+
+		count = 0;
+		pfd[count].fd = loop->wakeup->fd;
+		pfd[count].events = POLLIN;
+		pfd[count].revents = 0;
+		count++;
+
+#if ASYNC_NETIO_USE_IO_URING
+		// file ops on the ring count too, and those come back as completions, not posts
+		if ( loop->uring != NULL )
+		{
+			AsyncIO_URingSubmit( loop );
+
+			pfd[count].fd = loop->uring->fd;
+			pfd[count].events = POLLIN;
+			pfd[count].revents = 0;
+			count++;
+		}
+#endif
+
+		err = poll( pfd, count, -1 );
+		require( ( err >= 0 ) || ( errno == EINTR ), exit );
+
+		AsyncIO_DrainWakeup( loop->wakeup );
+#if ASYNC_NETIO_USE_IO_URING
+		AsyncIO_URingReapCompletions( loop );
+#endif
+	}
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+#endif
+
+AsyncIOLoop		AsyncIOLoop_Create( void )
+{
+	AsyncIOLoop loop = NULL, result = NULL;
+
+	loop = calloc( 1, sizeof( struct OpaqueAsyncIOLoop ) );
+	require( loop != NULL, exit );
+
+	loop->events.loop = loop;
+	loop->timers.current = AsyncIO_Milliseconds();
+	loop->now = loop->timers.current;
+
+#if ASYNC_NETIO_USE_RUN_LOOP
+	loop->kernelTimerDeadline = UINT64_MAX;
+#endif
+
+#if ASYNC_NETIO_USE_SELECT
+	FD_ZERO( &loop->readSet );
+	FD_ZERO( &loop->writeSet );
+#endif
+
+#if ASYNC_NETIO_USE_EPOLL
+	loop->ep = epoll_create1( EPOLL_CLOEXEC );
+	require( loop->ep >= 0, exit );
+#endif
+
+#if ASYNC_NETIO_USE_KQUEUE
+	loop->kq = kqueue();
+	require( loop->kq >= 0, exit );
+#endif
+
+	loop->wakeupWriteFD = kInvalidFD;
+#if !ASYNC_NETIO_USE_SELECT
+	loop->postHead = &loop->postStub;
+	loop->postTail = &loop->postStub;
+
+	int err;
+	err = AsyncIOLoop_SetBatchSize( loop, 0, false );
+	require( err == 0, exit );
+
+	err = AsyncIO_CreateWakeup( loop );
+	require( err == 0, exit );
+#endif
+
+	result = loop;
+	loop = NULL;
+
+exit:
+
+	if ( loop != NULL )
+	{
+		AsyncIOLoop_Destroy( loop );
+	}
+
+	return result;
+}
+
+void			AsyncIOLoop_Destroy( AsyncIOLoop loop )
+{
+	uint32_t i, j;
+	int released = 0;
+
+	require( loop != NULL, exit );
+	check( loop->inProgress == NULL );
+
+#if !ASYNC_NETIO_USE_SELECT
+	// if that can't be done, the loop is leaked rather than freed out from under the workers
+	if ( AsyncIO_DrainOffloads( loop ) != 0 )
+	{
+		dlog( kDebugLevelError, "AsyncIOLoop_Destroy: offloaded work still outstanding, not destroying\n" );
+		goto exit;
+	}
+#endif
+
+	// anything that wasn't released goes now, descriptor and all, while there's still a kernel
+	//	registration to take it out of (the wakeup and the ring are ours, they go below)
+	for ( i = 0; i < loop->numSlabs; i++ )
+	{
+		for ( j = 0; j < kAsyncIOSlabChunkSize; j++ )
+		{
+			AsyncIO anio = &loop->slabs[i][j];
+
+			if ( ( anio->type == 0 ) || ( anio->type == kAIO_TYPE_WAKEUP ) || ( anio->type == kAIO_TYPE_URING ) )
+				continue;
+
+			AsyncIO_Release( anio, true );
+			released++;
+		}
+	}
+	if ( released > 0 ) { dlog( kDebugLevelTrace, "AsyncIOLoop_Destroy: released %d AsyncIOs\n", released ); }
+
+	if ( anioCurrentLoop == loop )
+	{
+		anioCurrentLoop = NULL;
+	}
+
+	if ( anioDefaultLoop == loop )
+	{
+		anioDefaultLoop = NULL;
+	}
+
+#if ASYNC_NETIO_USE_IO_URING
+	if ( loop->uring != NULL )
+	{
+		AsyncIO_URingDispose( loop->uring );
+		loop->uring = NULL;
+	}
+#endif
+
+	if ( loop->wakeup != NULL )
+	{
+		// with an eventfd, both ends are the same descriptor
+		if ( loop->wakeupWriteFD == loop->wakeup->fd )
+		{
+			loop->wakeupWriteFD = kInvalidFD;
+		}
+		ForgetAsyncIO( &loop->wakeup, true );
+	}
+	ForgetFD( &loop->wakeupWriteFD );
+
+#if ASYNC_NETIO_USE_EPOLL
+	ForgetFD( &loop->ep );
+#endif
+
+#if ASYNC_NETIO_USE_POLL
+	ForgetMem( &loop->pollFDs );
+	ForgetMem( &loop->pollOwners );
+	loop->numPollFDs = 0;
+	loop->maxPollFDs = 0;
+#endif
+
+#if ASYNC_NETIO_USE_KQUEUE
+	ForgetFD( &loop->kq );
+#endif
+
+#if !ASYNC_NETIO_USE_SELECT
+	ForgetMem( &loop->batch );
+
+	// posts that never got run are dropped
+	if ( loop->postHead != NULL )
+	{
+		AsyncIOTask *task;
+		while ( ( task = AsyncIO_PopTask( loop ) ) != NULL )
+		{
+			ForgetMem( &task );
+		}
+	}
+#endif
+
+	ForgetMem( &loop->stats );
+
+	while ( loop->numSlabs > 0 )
+	{
+		loop->numSlabs--;
+		ForgetMem( &loop->slabs[loop->numSlabs] );
+	}
+	ForgetMem( &loop->slabs );
+
+	ForgetMem( &loop );
+
+exit:
+	;
+}
+
+int				AsyncIOLoop_Stop( AsyncIOLoop loop )
+{
+	int result = -1;
+
+	require( loop != NULL, exit );
+
+	__atomic_store_n( &loop->stopRequested, 1, __ATOMIC_RELEASE );
+
+#if !ASYNC_NETIO_USE_SELECT
+	AsyncIOLoop_Wakeup( loop );
+#endif
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+#if !ASYNC_NETIO_USE_SELECT
+// the task is freed once it has run
+static void		AsyncIOLoop_PostTask( AsyncIOLoop loop, AsyncIOTask *task )
+{
+	AsyncIO_PushTask( loop, task );
+
+	// only the first post since the loop last looked needs to wake it
+	if ( !__atomic_exchange_n( &loop->postDoorbell, 1, __ATOMIC_SEQ_CST ) )
+	{
+		AsyncIOLoop_Wakeup( loop );
+	}
+}
+#endif
+
+int				AsyncIOLoop_Post( AsyncIOLoop loop, AsyncIOTaskFunction function, void * context )
+{
+	int result = -1;
+
+	require( loop != NULL, exit );
+	require( function != NULL, exit );
+
+#if ASYNC_NETIO_USE_SELECT
+	// no wakeup to ring
+	require( 0, exit );
+#else
+	AsyncIOTask *task = malloc( sizeof( AsyncIOTask ) );
+	require( task != NULL, exit );
+
+	task->function = function;
+	task->context = context;
+	AsyncIOLoop_PostTask( loop, task );
+
+	result = 0;
+#endif
+
+exit:
+
+	return result;
+}
+
+int				AsyncIO_Post( AsyncIOTaskFunction function, void * context )
+{
+	return AsyncIOLoop_Post( anioDefaultLoop, function, context );
+}
+
+int				AsyncIOLoop_SetBatchSize( AsyncIOLoop loop, int maxEvents, bool adaptive )
+{
+	int result = -1;
+
+	require( loop != NULL, exit );
+
+#if ASYNC_NETIO_USE_SELECT
+	// select() already hands back everything that's ready
+	(void)maxEvents;
+	(void)adaptive;
+#else
+	// the buffer may be in use
+	require( loop->dispatching == 0, exit );
+
+	if ( maxEvents <= 0 )
+	{
+		maxEvents = kAsyncIODefaultBatchSize;
+	}
+
+	void *batch = realloc( loop->batch, maxEvents * sizeof( *loop->batch ) );
+	require( batch != NULL, exit );
+
+	loop->batch = batch;
+	loop->batchMax = maxEvents;
+	loop->batchAdaptive = adaptive;
+
+	// adaptive starts small and grows as the kernel keeps filling it
+	loop->batchSize = adaptive ? Minimum( kAsyncIOMinBatchSize, maxEvents ) : maxEvents;
+#endif
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIOLoop_EnableStats( AsyncIOLoop loop, bool enable )
+{
+	int result = -1;
+
+	require( loop != NULL, exit );
+
+	if ( enable && ( loop->stats == NULL ) )
+	{
+		loop->stats = calloc( 1, sizeof( AsyncIOStats ) );
+		require( loop->stats != NULL, exit );
+	}
+	else if ( !enable )
+	{
+		ForgetMem( &loop->stats );
+	}
+	loop->passMark = 0;
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIOLoop_GetStats( AsyncIOLoop loop, AsyncIOStats *outStats, bool reset )
+{
+	int result = -1;
+
+	require( loop != NULL, exit );
+	require( outStats != NULL, exit );
+	require_quiet( loop->stats != NULL, exit );
+
+	*outStats = *loop->stats;
+	if ( reset )
+	{
+		memset( loop->stats, 0, sizeof( AsyncIOStats ) );
+	}
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIO_GetStats( AsyncIOStats *outStats, bool reset )
+{
+	return AsyncIOLoop_GetStats( AsyncIO_CurrentLoop(), outStats, reset );
+}
+
+int				AsyncIOLoop_SetOverloadPolicy( AsyncIOLoop loop, uint32_t lagHigh, uint32_t lagLow, uint32_t outstandingHigh, uint32_t outstandingLow )
+{
+	int result = -1;
+	uint32_t i, j;
+
+	require( loop != NULL, exit );
+	require( lagLow <= lagHigh, exit );
+	require( outstandingLow <= outstandingHigh, exit );
+
+#if ASYNC_NETIO_USE_SELECT
+	// nothing measures the lag
+	require( ( lagHigh == 0 ) && ( outstandingHigh == 0 ), exit );
+#endif
+
+	loop->overloadLagHigh = lagHigh;
+	loop->overloadLagLow = lagLow;
+	loop->overloadOutstandingHigh = outstandingHigh;
+	loop->overloadOutstandingLow = outstandingLow;
+	loop->overloadEnabled = ( lagHigh > 0 ) || ( outstandingHigh > 0 );
+	loop->overloadLag = 0;
+	loop->passMark = 0;
+
+	// turning it off lets everything back in
+	if ( !loop->overloadEnabled && loop->shedding )
+	{
+		loop->shedding = false;
+		for ( i = 0; i < loop->numSlabs; i++ )
+		{
+			for ( j = 0; j < kAsyncIOSlabChunkSize; j++ )
+			{
+				if ( loop->slabs[i][j].type == kAIO_TYPE_LISTENER )
+				{
+					AsyncIO_PauseListener( &loop->slabs[i][j], false );
+				}
+			}
+		}
+	}
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+bool			AsyncIOLoop_IsOverloaded( AsyncIOLoop loop )
+{
+	return ( loop != NULL ) && loop->shedding;
+}
+
+AsyncIOLoop		AsyncIO_GetLoop( AsyncIO anio )
+{
+	return ( anio != NULL ) ? anio->loop : NULL;
+}
+
+AsyncIOLoop		AsyncIOLoop_GetDefault( void )
+{
+	return anioDefaultLoop;
+}
+
+AsyncIOLoop		AsyncIOLoop_GetCurrent( void )
+{
+	return AsyncIO_CurrentLoop();
+}
+
+AsyncIOLoop		AsyncIOLoop_SetCurrent( AsyncIOLoop loop )
+{
+	AsyncIOLoop previous = anioCurrentLoop;
+
+	anioCurrentLoop = loop;
+
+	return previous;
+}
+
+int AsyncIO_Initialize( int flags )
+{
+	int result = -1;
+
+	require_action_quiet( anioDefaultLoop == NULL, exit, result = 0 );
+
+#if __APPLE__
+	int enableRunLoop = 0;
+	
+	if ( ( flags & kAsyncIOFlags_UseRunLoop ) != 0 )
+		enableRunLoop = 1;
+#else
+	(void)flags;
+#endif
+
+	anioDefaultLoop = AsyncIOLoop_Create();
+	require( anioDefaultLoop != NULL, exit );
+
+#if ASYNC_NETIO_USE_RUN_LOOP
+
+	if ( enableRunLoop )
+	{
+		anioDescriptorRef = CFFileDescriptorCreate( kCFAllocatorDefault,
+			anioDefaultLoop->kq,
+			false,
+			AsyncIO_CFFileDescriptorCallBack,
+			NULL );
+		require( anioDescriptorRef != NULL, exit );
+
+		CFFileDescriptorEnableCallBacks( anioDescriptorRef, kCFFileDescriptorReadCallBack );
+
+		// hopefully this doesn't fail...
+		anioSourceRef = CFFileDescriptorCreateRunLoopSource( kCFAllocatorDefault, anioDescriptorRef, 0 );
+		require( anioSourceRef != NULL, exit );
+
+		CFRunLoopAddSource( CFRunLoopGetMain(), anioSourceRef, kCFRunLoopDefaultMode );
+
+		CFRelease( anioSourceRef );
+		
+	}
+
+#endif
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+
+
+#if ASYNC_NETIO_USE_EPOLL || ASYNC_NETIO_USE_POLL
+
+// converts a timeval into an epoll_wait() (or poll()) timeout, and shortens it if a timer is due first
+static int	AsyncIO_WaitTimeout( AsyncIOLoop loop, struct timeval *timeout )
+{
+	struct timeval storage;
+	int result = -1;
+
+	timeout = AsyncIO_TimerTimeout( loop, timeout, &storage );
+	if ( timeout != NULL )
+	{
+		int64_t ms = ( (int64_t)timeout->tv_sec * 1000 ) + ( ( timeout->tv_usec + 999 ) / 1000 );
+		result = (int)Minimum( ms, INT32_MAX );
+	}
+
+	return result;
+}
+
+#endif
+
+#if ASYNC_NETIO_USE_EPOLL
+
+static void	AsyncIO_DispatchEpollEvent( AsyncIOLoop loop, struct epoll_event *ev )
+{
+	AsyncIO anio = AsyncIO_FromHandle( loop, (uintptr_t)ev->data.u64 );
+	uint32_t events = ev->events;
+	bool readable, writable, eof;
+
+	// released by an earlier callback in this batch
+	if ( anio == NULL )
+		return;
+
+	// errors and hangups get reported whether we asked for them or not, so hand
+	//	them to whichever direction is waiting -- the read or write will tell the caller what happened
+	readable = anio->notifyOnRead && ( ( events & ( EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) != 0 );
+	writable = anio->notifyOnWrite && ( ( events & ( EPOLLOUT | EPOLLHUP | EPOLLERR ) ) != 0 );
+	eof = ( events & ( EPOLLRDHUP | EPOLLHUP ) ) != 0;
+
+#if ASYNC_NETIO_USE_IO_URING
+	if ( anio->type == kAIO_TYPE_URING )
+	{
+		AsyncIO_URingReapCompletions( loop );
+		return;
+	}
+#endif
+
+	if ( anio->type == kAIO_TYPE_WAKEUP )
+	{
+		AsyncIO_DrainWakeup( anio );
+		return;
+	}
+
+	if ( ( anio->type == kAIO_TYPE_PROC ) || ( anio->type == kAIO_TYPE_SIGNAL ) )
+	{
+		if ( readable )
+		{
+			AsyncIO_DispatchMonitor( loop, anio );
+		}
+		return;
+	}
+
+	loop->inProgress = anio;
+
+	if ( readable )
+	{
+		if ( anio->type == kAIO_TYPE_LISTENER )
+			AsyncIO_DeliverNewConnections( anio, anio->fd );
+		else if ( anio->type == kAIO_TYPE_CONNECTION )
+		{
+			anio->notifyOnRead = anio->persistent;
+			AsyncIO_CallBack( anio, kAIO_DATA_AVAILABLE, anio->fd );
+
+			if ( eof && ( loop->inProgress == anio ) )	// make sure it didn't get freed
+			{
+				dlog( kDebugLevelChatty, "epoll: EPOLLRDHUP hit\n" );
+
+				// let them know the socket closed
+				AsyncIO_CallBack( anio, kAIO_CONNECTION_CLOSED, anio->fd );
+			}
+		}
+		else if ( anio->type == kAIO_TYPE_DATAGRAM )
+			AsyncIO_ReceiveDatagrams( anio );
+	}
+
+	if ( writable && ( loop->inProgress == anio ) && ( anio->notifyOnWrite ) )
+	{
+		AsyncIO_DeliverWritable( anio, anio->fd );
+	}
+
+	// emulate EV_ONESHOT -- only drop the interest the callbacks didn't ask for again (on the
+	//	way into the next wait), so the common "read, then wait for more" pattern costs nothing
+	if ( ( loop->inProgress == anio ) && ( AsyncIO_EpollInterest( anio ) != anio->epollEvents ) )
+	{
+		AsyncIO_MarkEpollDirty( anio );
+	}
+
+	loop->inProgress = NULL;
+}
+
+static void	AsyncIO_DispatchEpollEvents( AsyncIOLoop loop, struct epoll_event *events, int num )
+{
+	AsyncIO anio;
+	int i;
+
+	loop->dispatching++;
+
+	// when a lot of children go at once, they're all reaped in one go before any of the callbacks
+	for ( i = 0; i < num; i++ )
+	{
+		anio = AsyncIO_FromHandle( loop, (uintptr_t)events[i].data.u64 );
+		if ( ( anio != NULL ) && ( anio->type == kAIO_TYPE_PROC ) && anio->notifyOnRead )
+		{
+			AsyncIO_ReapProcess( anio );
+		}
+	}
+
+	for ( i = 0; i < num; i++ )
+	{
+		AsyncIO_DispatchEpollEvent( loop, &events[i] );
+	}
+
+	loop->dispatching--;
+}
+
+// the descriptors epoll refused are always ready, so whatever of them is armed gets delivered
+//	after every wait -- the list is taken up front, so re-arming from a callback waits for the next pass
+static int	AsyncIO_DispatchEpollReady( AsyncIOLoop loop )
+{
+	AsyncIO pending, anio;
+	struct epoll_event ev;
+	int num = 0;
+
+	pending = loop->epollReady;
+	loop->epollReady = NULL;
+	if ( pending != NULL )
+	{
+		pending->epollPrevDirty = &pending;
+	}
+
+	loop->dispatching++;
+
+	// a callback releasing one that's still pending unlinks it from here
+	while ( ( anio = pending ) != NULL )
+	{
+		AsyncIO_UnmarkEpollDirty( anio );
+
+		memset( &ev, 0, sizeof( ev ) );
+		ev.events = ( anio->notifyOnRead ? EPOLLIN : 0 ) | ( anio->notifyOnWrite ? EPOLLOUT : 0 );
+		ev.data.u64 = AsyncIO_Handle( anio );
+		AsyncIO_DispatchEpollEvent( loop, &ev );
+		num++;
+	}
+
+	loop->dispatching--;
+
+	return num;
+}
+
+#endif
+
+
+#if ASYNC_NETIO_USE_POLL
+
+// poll() marks the entries in place, and the callbacks can rearrange them, so the ready ones are
+//	picked out by handle first -- stopping as soon as all of them are found.  if there are more
+//	than fit, the next pass starts where this one left off, so the far end still gets its turn
+static int	AsyncIO_CollectPollEvents( AsyncIOLoop loop, AsyncIOPollEvent *events, int maxEvents, int ready )
+{
+	int num = 0, count = loop->numPollFDs;
+	int i, k;
+
+	if ( ( ready <= 0 ) || ( count == 0 ) )
+		return 0;
+
+	for ( k = 0; ( k < count ) && ( num < ready ) && ( num < maxEvents ); k++ )
+	{
+		i = ( loop->pollNext + k ) % count;
+		if ( loop->pollFDs[i].revents != 0 )
+		{
+			events[num].handle = AsyncIO_Handle( loop->pollOwners[i] );
+			events[num].revents = loop->pollFDs[i].revents;
+			num++;
+		}
+	}
+
+	loop->pollNext = ( num == maxEvents ) ? ( ( loop->pollNext + k ) % count ) : 0;
+
+	return num;
+}
+
+static void	AsyncIO_DispatchPollEvent( AsyncIOLoop loop, AsyncIOPollEvent *ev )
+{
+	AsyncIO anio = AsyncIO_FromHandle( loop, ev->handle );
+	short revents = ev->revents;
+	bool readable, writable, eof;
+
+	// released by an earlier callback in this batch
+	if ( anio == NULL )
+		return;
+
+	// same as epoll -- errors and hangups go to whichever direction is waiting
+	readable = anio->notifyOnRead && ( ( revents & ( POLLIN | POLLRDHUP | POLLHUP | POLLERR | POLLNVAL ) ) != 0 );
+	writable = anio->notifyOnWrite && ( ( revents & ( POLLOUT | POLLHUP | POLLERR | POLLNVAL ) ) != 0 );
+	eof = ( revents & ( POLLRDHUP | POLLHUP ) ) != 0;
+
+	if ( anio->type == kAIO_TYPE_WAKEUP )
+	{
+		AsyncIO_DrainWakeup( anio );
+		return;
+	}
+
+	loop->inProgress = anio;
+
+	if ( readable )
+	{
+		if ( anio->type == kAIO_TYPE_LISTENER )
+			AsyncIO_DeliverNewConnections( anio, anio->fd );
+		else if ( anio->type == kAIO_TYPE_CONNECTION )
+		{
+			anio->notifyOnRead = anio->persistent;
+			AsyncIO_CallBack( anio, kAIO_DATA_AVAILABLE, anio->fd );
+
+			if ( eof && ( loop->inProgress == anio ) )	// make sure it didn't get freed
+			{
+				dlog( kDebugLevelChatty, "poll: POLLHUP hit\n" );
+
+				// let them know the socket closed
+				AsyncIO_CallBack( anio, kAIO_CONNECTION_CLOSED, anio->fd );
+			}
+		}
+		else if ( anio->type == kAIO_TYPE_DATAGRAM )
+			AsyncIO_ReceiveDatagrams( anio );
+	}
+
+	if ( writable && ( loop->inProgress == anio ) && ( anio->notifyOnWrite ) )
+	{
+		AsyncIO_DeliverWritable( anio, anio->fd );
+	}
+
+	// one shot, unless the callbacks asked again
+	if ( loop->inProgress == anio )
+	{
+		AsyncIO_UpdatePollRegistration( anio );
+	}
+
+	loop->inProgress = NULL;
+}
+
+static void	AsyncIO_DispatchPollEvents( AsyncIOLoop loop, AsyncIOPollEvent *events, int num )
+{
+	int i;
+
+	loop->dispatching++;
+
+	for ( i = 0; i < num; i++ )
+	{
+		AsyncIO_DispatchPollEvent( loop, &events[i] );
+	}
+
+	loop->dispatching--;
+}
+
+#endif
+
+
+#if ASYNC_NETIO_USE_KQUEUE
+
+static void	AsyncIO_DispatchKevents( AsyncIOLoop loop, AsyncIOKevent *events, int num )
+{
+	AsyncIO anio;
+	int ident;
+
+	loop->dispatching++;
+
+	int i;
+
+	// when a lot of children go at once, they're all reaped in one go before any of the callbacks
+	for ( i = 0; i < num; i++ )
+	{
+		if ( ( events[i].filter == EVFILT_PROC ) && !( events[i].flags & EV_ERROR ) )
+		{
+			anio = AsyncIO_FromHandle( loop, (uintptr_t)events[i].udata );
+			if ( anio != NULL )
+			{
+				AsyncIO_ReapProcess( anio );
+			}
+		}
+	}
+
+	for ( i = 0; i < num; i++ )
+	{
+		if ( events[i].flags & EV_ERROR )
+		{
+			AsyncIO_ChangeFailed( loop, &events[i] );
+			continue;
+		}
+
+		anio = AsyncIO_FromHandle( loop, (uintptr_t)events[i].udata );
+
+		// released by an earlier callback in this batch
+		if ( anio == NULL )
+			continue;
+
+		loop->inProgress = anio;
+
+		switch ( events[i].filter )
+		{
+			case EVFILT_READ:
+				{
+					ident = (int)events[i].ident;
+					if ( anio->type == kAIO_TYPE_LISTENER )
+						AsyncIO_DeliverNewConnections( anio, ident );
+					else if ( anio->type == kAIO_TYPE_CONNECTION )
+					{
+						anio->notifyOnRead = anio->persistent;
+						AsyncIO_CallBack( anio, kAIO_DATA_AVAILABLE, ident );
+					}
+					else if ( anio->type == kAIO_TYPE_DATAGRAM )
+						AsyncIO_ReceiveDatagrams( anio );
+					else if ( anio->type == kAIO_TYPE_WAKEUP )
+						AsyncIO_DrainWakeup( anio );
+				}
+				break;
+
+			case EVFILT_WRITE:
+				{
+					ident = (int)events[i].ident;
+					AsyncIO_DeliverWritable( anio, ident );
+				}
+				break;
+
+			case EVFILT_TIMER:
+				{
+					// the run loop's deadline timer -- the wheel itself gets run below
+#if ASYNC_NETIO_USE_RUN_LOOP
+					loop->kernelTimerDeadline = UINT64_MAX;
+#endif
+				}
+				break;
+
+			case EVFILT_PROC:
+				{
+					ident = (int)events[i].ident;
+					AsyncIO_CallBack( anio, kAIO_PROCESS_EXITED, ident );
+				}
+				break;
+
+			case EVFILT_SIGNAL:
+				{
+					ident = (int)events[i].ident;
+					AsyncIO_CallBack( anio, kAIO_SIGNAL_DELIVERED, ident );
+				}
+		}
+
+		if ( events[i].flags & EV_EOF )
+		{
+			//check( kv.filter == EVFILT_READ );
+			if ( events[i].filter == EVFILT_READ )
+			{
+				// adding log message - can't remember if this works...
+				dlog( kDebugLevelChatty, "kevent: EV_EOF hit\n" );
+
+				require_continue_quiet( loop->inProgress == anio );	// make sure it didn't get freed
+
+				ident = (int)events[i].ident;
+
+				// let them know the socket closed
+				AsyncIO_CallBack( anio, kAIO_CONNECTION_CLOSED, ident );
+			}
+			else
+			{
+				// why do we get these?
+			}
+		}
+		
+		loop->inProgress = NULL;
+	}
+
+	loop->dispatching--;
+}
+
+#endif
+
+
+int				AsyncIO_WaitForEvents( AsyncIOEventsContext *outEventsContext, struct timeval *timeout )
+{
+	int result = -1;
+	
+	require( outEventsContext != NULL, exit );
+
+	AsyncIOLoop loop = AsyncIO_CurrentLoop();
+	require( loop != NULL, exit );
+
+	AsyncIOEventsContext ctx = &loop->events;
+	*outEventsContext = ctx;
+
+#if !ASYNC_NETIO_USE_SELECT
+	AsyncIO_FlushDatagramSends( loop );
+#endif
+
+
+#if ASYNC_NETIO_USE_SELECT
+
+	// take a look at <https://www.freertos.org/Pend-on-multiple-rtos-objects.html>
+	// see if it's possible to have other objects we could wait on, inside the lwip select (we might need to have it call back to us)
+
+#warning "FIX ME: select case never posts kAIO_CONNECTION_CLOSED events for read"
+	// we don't handle the EV_EOF case
+
+	int i;
+	//struct timeval timeout;
+	struct timeval *to;
+
+	FD_ZERO( &ctx->readfds );
+	FD_ZERO( &ctx->writefds );
+	ctx->maxFd = -1;
+	for ( i = 0; i < LWIP_SELECT_MAXNFDS; i++ )
+	{
+		if ( FD_ISSET( i, &loop->readSet ) )
+		{
+			ctx->maxFd = i;
+			FD_SET( i, &ctx->readfds );
+		}
+		if ( FD_ISSET( i, &loop->writeSet ) )
+		{
+			ctx->maxFd = i;
+			FD_SET( i, &ctx->writefds );
+		}
+	}
+
+	// if there's nothing to monitor, we can't do anything here
+	//require( maxFd != -1, exit );
+	
+	struct timeval aio_timeout;
+	to = AsyncIO_TimerTimeout( loop, timeout, &aio_timeout );
+
+	require( ( ctx->maxFd >= 0 ) || ( to != NULL ), exit );
+
+	if ( ctx->maxFd == -1 )
+	{
+		ctx->num = select( 0, NULL, NULL, NULL, to );
+	}
+	else
+	{
+		ctx->num = select( ctx->maxFd+1, &ctx->readfds, &ctx->writefds, NULL, to );
+	}
+#endif
+
+#if ASYNC_NETIO_USE_KQUEUE
+	struct timespec	*to;
+	struct timespec timeout_spec;
+	struct timeval aio_timeout;
+
+	timeout = AsyncIO_TimerTimeout( loop, timeout, &aio_timeout );
+	if ( timeout == NULL )
+	{
+		to = NULL;
+	}
+	else
+	{
+		timeout_spec.tv_sec = timeout->tv_sec;
+		timeout_spec.tv_nsec = timeout->tv_usec * 1000;
+		to = &timeout_spec;
+	}
+
+	errno = 0;
+	ctx->num = AsyncIO_KeventWait( loop, ctx->kv, kMaxAsyncIOEvents, to );
+#endif
+
+#if ASYNC_NETIO_USE_EPOLL
+#if ASYNC_NETIO_USE_IO_URING
+	AsyncIO_URingSubmit( loop );
+#endif
+	AsyncIO_FlushEpollChanges( loop );
+	errno = 0;
+	ctx->num = epoll_wait( loop->ep, ctx->ev, kMaxAsyncIOEvents, ( loop->epollReady != NULL ) ? 0 : AsyncIO_WaitTimeout( loop, timeout ) );
+	if ( ( ctx->num < 0 ) && ( errno == EINTR ) )
+	{
+		ctx->num = 0;
+	}
+#endif
+
+#if ASYNC_NETIO_USE_POLL
+	errno = 0;
+	ctx->num = poll( loop->pollFDs, (nfds_t)loop->numPollFDs, AsyncIO_WaitTimeout( loop, timeout ) );
+	if ( ( ctx->num < 0 ) && ( errno == EINTR ) )
+	{
+		ctx->num = 0;
+	}
+	ctx->num = AsyncIO_CollectPollEvents( loop, ctx->pv, kMaxAsyncIOEvents, ctx->num );
+#endif
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+int				AsyncIO_ProcessEvents( AsyncIOEventsContext inEventsContext )
+{
+	int result = -1;
+	AsyncIOEventsContext ctx = inEventsContext;
+	
+	require( inEventsContext != NULL, exit );
+
+	AsyncIOLoop loop = ctx->loop;
+	loop->now = AsyncIO_Milliseconds();
+
+#if ASYNC_NETIO_USE_SELECT
+
+	if ( ctx->num > 0 )
+	{
+		for ( i = 0; i <= ctx->maxFd; i++ )
+		{
+			if ( ctx->num == 0 )
+				break;
+
+			if ( FD_ISSET( i, &ctx->readfds ) )
+			{
+				ctx->num--;
+
+				AsyncIO anio;
+				lwip_socket_get_userdata( i, (void**)&anio );
+
+				// clear it before call back, because they may request it again DURING the callback
+				FD_CLR( i, &loop->readSet );
+
+				loop->inProgress = anio;
+				if ( anio->type == kAIO_TYPE_LISTENER )
+					AsyncIO_DeliverNewConnections( anio, anio->fd );
+				else if ( anio->type == kAIO_TYPE_CONNECTION )
+				{
+					anio->notifyOnRead = false;
+					AsyncIO_CallBack( anio, kAIO_DATA_AVAILABLE, anio->fd );
+				}
+				loop->inProgress = NULL;
+			}
+
+			if ( FD_ISSET( i, &ctx->writefds ) )
+			{
+				num--;
+
+				AsyncIO anio;
+				lwip_socket_get_userdata( i, (void**)&anio );
+
+				// clear it before call back, because they may request it again DURING the callback
+				FD_CLR( i, &loop->writeSet );
+
+				loop->inProgress = anio;
+				AsyncIO_DeliverWritable( anio, anio->fd );
+				loop->inProgress = NULL;
+			}
+		}
+
+		check( ctx->num == 0 );
+	}
+#endif
+
+#if ASYNC_NETIO_USE_KQUEUE
+	AsyncIO_DispatchKevents( loop, ctx->kv, ctx->num );
+#endif
+
+#if ASYNC_NETIO_USE_EPOLL
+	AsyncIO_DispatchEpollEvents( loop, ctx->ev, ctx->num );
+	AsyncIO_DispatchEpollReady( loop );
+#endif
+
+#if ASYNC_NETIO_USE_POLL
+	AsyncIO_DispatchPollEvents( loop, ctx->pv, ctx->num );
+#endif
+
+	AsyncIO_FireTimers( loop );
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
+
+
+
+#if !ASYNC_NETIO_USE_SELECT
+// grow while the kernel keeps filling the batch, shrink back down as things quiet down
+static void	AsyncIO_AdaptBatchSize( AsyncIOLoop loop, int num )
+{
+	if ( !loop->batchAdaptive )
+		return;
+
+	if ( ( num == loop->batchSize ) && ( loop->batchSize < loop->batchMax ) )
+	{
+		loop->batchSize = Minimum( loop->batchSize * 2, loop->batchMax );
+	}
+	else if ( ( num < ( loop->batchSize / 4 ) ) && ( loop->batchSize > kAsyncIOMinBatchSize ) )
+	{
+		loop->batchSize = Maximum( loop->batchSize / 2, kAsyncIOMinBatchSize );
+	}
+}
+#endif
+
+#if !ASYNC_NETIO_USE_SELECT
+static void	AsyncIO_CheckOverload( AsyncIOLoop loop )
+{
+	uint32_t outstanding = loop->numConnections + (uint32_t)__atomic_load_n( &loop->offloadsPending, __ATOMIC_RELAXED );
+	bool over, under;
+	uint32_t i, j;
+
+	over = ( ( loop->overloadLagHigh > 0 ) && ( loop->overloadLag > loop->overloadLagHigh ) ) ||
+		( ( loop->overloadOutstandingHigh > 0 ) && ( outstanding > loop->overloadOutstandingHigh ) );
+	under = ( ( loop->overloadLagHigh == 0 ) || ( loop->overloadLag < loop->overloadLagLow ) ) &&
+		( ( loop->overloadOutstandingHigh == 0 ) || ( outstanding <= loop->overloadOutstandingLow ) );
+
+	// the gap between high and low keeps it from flapping
+	require_quiet( loop->shedding ? under : over, exit );
+
+	loop->shedding = !loop->shedding;
+	dlog( kDebugLevelTrace, "AsyncIO: %s listeners (lag %lluus, %u outstanding)\n", loop->shedding ? "pausing" : "resuming",
+		(unsigned long long)loop->overloadLag, (unsigned int)outstanding );
+
+	if ( loop->shedding && ( loop->stats != NULL ) )
+	{
+		loop->stats->overloads++;
+	}
+
+	// it doesn't happen often, so just look through everything
+	for ( i = 0; i < loop->numSlabs; i++ )
+	{
+		for ( j = 0; j < kAsyncIOSlabChunkSize; j++ )
+		{
+			if ( loop->slabs[i][j].type == kAIO_TYPE_LISTENER )
+			{
+				AsyncIO_PauseListener( &loop->slabs[i][j], loop->shedding );
+			}
+		}
+	}
+
+exit:
+
+	return;
+}
+
+// the end of one pass (and the lag since we woke), and the start of the wait
+static inline void	AsyncIO_LoopWaiting( AsyncIOLoop loop )
+{
+	if ( ( loop->stats != NULL ) || loop->overloadEnabled )
+	{
+		uint64_t now = AsyncIO_Microseconds();
+
+		if ( loop->passMark != 0 )
+		{
+			uint64_t lag = now - loop->passMark;
+
+			if ( loop->stats != NULL )
+			{
+				AsyncIO_StatsRecord( &loop->stats->loopLag, lag );
+			}
+
+			if ( loop->overloadEnabled )
+			{
+				// an eighth of each new pass, so one slow callback doesn't trip it
+				loop->overloadLag = loop->overloadLag - ( loop->overloadLag / 8 ) + ( lag / 8 );
+				AsyncIO_CheckOverload( loop );
+			}
+		}
+		loop->passMark = now;
+	}
+}
+
+static inline void	AsyncIO_LoopWoke( AsyncIOLoop loop, int num )
+{
+	loop->now = AsyncIO_Milliseconds();
+
+	if ( ( loop->stats != NULL ) || loop->overloadEnabled )
+	{
+		uint64_t now = AsyncIO_Microseconds();
+
+		if ( loop->stats != NULL )
+		{
+			// an EINTR retry can go round without a mark
+			if ( loop->passMark != 0 )
+			{
+				loop->stats->usBlocked += now - loop->passMark;
+			}
+
+			loop->stats->wakeups++;
+			loop->stats->events += num;
+			AsyncIO_StatsRecord( &loop->stats->eventsPerWakeup, num );
+		}
+		loop->passMark = now;
+	}
+}
+
+// while the listeners are paused, nothing might wake us to notice it's quiet again
+static inline int64_t	AsyncIO_OverloadTimeout( AsyncIOLoop loop, int64_t timeout_ms )
+{
+	if ( loop->shedding && ( ( timeout_ms < 0 ) || ( timeout_ms > kAsyncIOOverloadRecheck ) ) )
+	{
+		timeout_ms = kAsyncIOOverloadRecheck;
+	}
+
+	return timeout_ms;
+}
+#endif
+
+int AsyncIO_Run( bool keepRunning )
+{
+	return AsyncIOLoop_Run( AsyncIO_CurrentLoop(), keepRunning );
+}
+
+int AsyncIOLoop_Run( AsyncIOLoop loop, bool keepRunning )
+{
+	int result = -1;
+	AsyncIOLoop previousLoop = anioCurrentLoop;
+
+	require( loop != NULL, exit );
+
+	// anything created from a callback belongs to this loop
+	anioCurrentLoop = loop;
+
+
+
+	check( loop->inProgress == NULL );
+
+#if TARGET_OS_FREERTOS
+	UBaseType_t stackFreeNow, stackFree = uxTaskGetStackHighWaterMark( NULL );
+
+	if ( keepRunning )
+	{
+		dlog( kDebugLevelTrace, "AsyncIO_Run: current stack low water mark is %lu\n", (unsigned long)stackFree );
+	}
+#endif
+
+#if ASYNC_NETIO_USE_SELECT
+
+	// take a look at <https://www.freertos.org/Pend-on-multiple-rtos-objects.html>
+	// see if it's possible to have other objects we could wait on, inside the lwip select (we might need to have it call back to us)
+
+#warning "FIX ME: select case never posts kAIO_CONNECTION_CLOSED events for read"
+	// we don't handle the EV_EOF case
+
+	fd_set	readfds;
+	fd_set	writefds;
+	int		maxFd;
+
+	while ( 1 )
+	{
+		int i;
+		struct timeval timeout;
+		struct timeval *to;
+
+		FD_ZERO( &readfds );
+		FD_ZERO( &writefds );
+		maxFd = -1;
+		for ( i = 0; i < LWIP_SELECT_MAXNFDS; i++ )
+		{
+			if ( FD_ISSET( i, &loop->readSet ) )
+			{
+				maxFd = i;
+				FD_SET( i, &readfds );
+			}
+			if ( FD_ISSET( i, &loop->writeSet ) )
+			{
+				maxFd = i;
+				FD_SET( i, &writefds );
+			}
+		}
+
+		// if there's nothing to monitor, we can't do anything here
+		//require( maxFd != -1, exit );
+		
+		#warning "FIX ME: we need to know when the next timer will fire"
+#if 1
+		to = AsyncIO_TimerTimeout( loop, NULL, &timeout );
+#else
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 0;
+		to = NULL;
+		if (!keepRunning )
+		{
+			to = &timeout;
+		}
+#endif
+
+		require( ( maxFd >= 0 ) || ( to != NULL ), exit );
+		int num;
+
+//if ( log_aio_hap_failed ) { dlog( kDebugLevelMax, "hap: AsyncIO_Run\n" ); }
+
+
+
+		if ( maxFd == -1 )
+		{
+			num = select( 0, NULL, NULL, NULL, to );
+		}
+		else
+		{
+			num = select( maxFd+1, &readfds, &writefds, NULL, to );
+		}
+		loop->now = AsyncIO_Milliseconds();
+
+		if ( num > 0 )
+		{
+			for ( i = 0; i <= maxFd; i++ )
+			{
+				if ( num == 0 )
+					break;
+
+				if ( FD_ISSET( i, &readfds ) )
+				{
+					num--;
+
+					AsyncIO anio;
+					lwip_socket_get_userdata( i, (void**)&anio );
+
+					// clear it before call back, because they may request it again DURING the callback
+					FD_CLR( i, &loop->readSet );
+
+					loop->inProgress = anio;
+					if ( anio->type == kAIO_TYPE_LISTENER )
+						AsyncIO_DeliverNewConnections( anio, anio->fd );
+					else if ( anio->type == kAIO_TYPE_CONNECTION )
+					{
+						anio->notifyOnRead = false;
+						AsyncIO_CallBack( anio, kAIO_DATA_AVAILABLE, anio->fd );
+					}
+					loop->inProgress = NULL;
+				}
+
+				if ( FD_ISSET( i, &writefds ) )
+				{
+					num--;
+
+					AsyncIO anio;
+					lwip_socket_get_userdata( i, (void**)&anio );
+
+					// clear it before call back, because they may request it again DURING the callback
+					FD_CLR( i, &loop->writeSet );
+
+					loop->inProgress = anio;
+					AsyncIO_DeliverWritable( anio, anio->fd );
+					loop->inProgress = NULL;
+				}
+			}
+
+			check( num == 0 );
+		}
+		else if ( num < 0 )
+		{
+			dlog( kDebugLevelTrace, "AsyncIO_Run: select returned %d (error = %d)\r\n", num, errno );
+			break;
+		}
+
+		AsyncIO_FireTimers( loop );
+
+		if ( !keepRunning )
+			break;
+
+#if TARGET_OS_FREERTOS
+		stackFreeNow = uxTaskGetStackHighWaterMark( NULL );
+		if ( stackFreeNow < stackFree )
+		{
+			stackFree = stackFreeNow;
+			dlog( kDebugLevelTrace, "AsyncIO_Run: current stack low water mark is now %lu\n", (unsigned long)stackFree );
+		}
+#endif
+	}
+#endif
+
+#if ASYNC_NETIO_USE_KQUEUE
+	struct timespec	*to;
+	struct timespec timeout;
+	bool	got_first_event;
+
+
+	got_first_event = false;
+	while ( true )
+	{
+		int num;
+		int64_t timeout_ms;
+
+		AsyncIO_FlushDatagramSends( loop );
+		AsyncIO_LoopWaiting( loop );
+
+		// for the first event, we always wait (as long as the next timer allows)...
+		timeout_ms = AsyncIO_TimerWheelTimeout( loop );
+		if ( ( !keepRunning ) && ( got_first_event ) )
+			timeout_ms = 0;
+		timeout_ms = AsyncIO_OverloadTimeout( loop, timeout_ms );
+
+		to = NULL;
+		if ( timeout_ms >= 0 )
+		{
+			timeout.tv_sec = (time_t)( timeout_ms / 1000 );
+			timeout.tv_nsec = (long)( ( timeout_ms % 1000 ) * 1000000 );
+			to = &timeout;
+		}
+		errno = 0;
+		num = AsyncIO_KeventWait( loop, loop->batch, loop->batchSize, to );
+		if ( num < 0 ) { dlog( kDebugLevelError, "AsyncIO: kevent result %d (error %d)\n", num, errno ); }
+#if __APPLE__
+		if ( ( num < 0 ) && ( errno == EINTR ) && ( debug_running_in_debugger() ) ) { dlog( kDebugLevelTrace, "AsyncIO: kevent signal in debugger, likely breakpoint, ignoring\n" ); continue; }
+#endif
+		require_quiet( num >= 0, exit );
+		AsyncIO_LoopWoke( loop, num );
+
+		AsyncIO_DispatchKevents( loop, loop->batch, num );
+		AsyncIO_AdaptBatchSize( loop, num );
+
+		if ( AsyncIO_FireTimers( loop ) > 0 )
+		{
+			num++;
+		}
+
+		if ( ( num == 0 ) && ( !keepRunning ) && ( got_first_event ) )
+		{
+			result = 0;
+			break;
+		}
+
+		if ( num > 0 )
+		{
+			got_first_event = true;
+		}
+
+		// AsyncIOLoop_Stop() from a callback or another thread
+		if ( __atomic_exchange_n( &loop->stopRequested, 0, __ATOMIC_ACQ_REL ) )
+		{
+			result = 0;
+			break;
+		}
+	}
+#endif
+
+#if ASYNC_NETIO_USE_EPOLL
+	bool	got_first_event;
+
+	got_first_event = false;
+	while ( true )
+	{
+		int timeout_ms;
+		int num;
+
+		AsyncIO_FlushDatagramSends( loop );
+		AsyncIO_LoopWaiting( loop );
+
+		// for the first event, we always wait (as long as the next timer allows)...
+		timeout_ms = AsyncIO_WaitTimeout( loop, NULL );
+		if ( ( !keepRunning ) && ( got_first_event ) )
+			timeout_ms = 0;
+		timeout_ms = (int)AsyncIO_OverloadTimeout( loop, timeout_ms );
+
+#if ASYNC_NETIO_USE_IO_URING
+		// everything the last pass queued goes to the kernel in one call
+		AsyncIO_URingSubmit( loop );
+#endif
+		AsyncIO_FlushEpollChanges( loop );
+
+		// no sense sleeping with something that's always ready waiting to go
+		if ( loop->epollReady != NULL )
+			timeout_ms = 0;
+
+		errno = 0;
+		num = epoll_wait( loop->ep, loop->batch, loop->batchSize, timeout_ms );
+		if ( ( num < 0 ) && ( errno == EINTR ) ) { dlog( kDebugLevelTrace, "AsyncIO: epoll_wait interrupted, ignoring\n" ); continue; }
+		if ( num < 0 ) { dlog( kDebugLevelError, "AsyncIO: epoll_wait result %d (error %d)\n", num, errno ); }
+		require_quiet( num >= 0, exit );
+		AsyncIO_LoopWoke( loop, num );
+
+		AsyncIO_DispatchEpollEvents( loop, loop->batch, num );
+		AsyncIO_AdaptBatchSize( loop, num );
+		num += AsyncIO_DispatchEpollReady( loop );
+
+		if ( AsyncIO_FireTimers( loop ) > 0 )
+		{
+			num++;
+		}
+
+		if ( ( num == 0 ) && ( !keepRunning ) && ( got_first_event ) )
+		{
+			result = 0;
+			break;
+		}
+
+		if ( num > 0 )
+		{
+			got_first_event = true;
+		}
+
+		// AsyncIOLoop_Stop() from a callback or another thread
+		if ( __atomic_exchange_n( &loop->stopRequested, 0, __ATOMIC_ACQ_REL ) )
+		{
+			result = 0;
+			break;
+		}
+	}
+#endif
+
+#if ASYNC_NETIO_USE_POLL
+	bool	got_first_event;
+
+	got_first_event = false;
+	while ( true )
+	{
+		int timeout_ms;
+		int num;
+
+		AsyncIO_FlushDatagramSends( loop );
+		AsyncIO_LoopWaiting( loop );
+
+		// for the first event, we always wait (as long as the next timer allows)...
+		timeout_ms = AsyncIO_WaitTimeout( loop, NULL );
+		if ( ( !keepRunning ) && ( got_first_event ) )
+			timeout_ms = 0;
+		timeout_ms = (int)AsyncIO_OverloadTimeout( loop, timeout_ms );
+
+		errno = 0;
+		num = poll( loop->pollFDs, (nfds_t)loop->numPollFDs, timeout_ms );
+		if ( ( num < 0 ) && ( errno == EINTR ) ) { dlog( kDebugLevelTrace, "AsyncIO: poll interrupted, ignoring\n" ); continue; }
+		if ( num < 0 ) { dlog( kDebugLevelError, "AsyncIO: poll result %d (error %d)\n", num, errno ); }
+		require_quiet( num >= 0, exit );
+
+		num = AsyncIO_CollectPollEvents( loop, loop->batch, loop->batchSize, num );
+		AsyncIO_LoopWoke( loop, num );
+
+		AsyncIO_DispatchPollEvents( loop, loop->batch, num );
+		AsyncIO_AdaptBatchSize( loop, num );
+
+		if ( AsyncIO_FireTimers( loop ) > 0 )
+		{
+			num++;
+		}
+
+		if ( ( num == 0 ) && ( !keepRunning ) && ( got_first_event ) )
+		{
+			result = 0;
+			break;
+		}
+
+		if ( num > 0 )
+		{
+			got_first_event = true;
+		}
+
+		// AsyncIOLoop_Stop() from a callback or another thread
+		if ( __atomic_exchange_n( &loop->stopRequested, 0, __ATOMIC_ACQ_REL ) )
+		{
+			result = 0;
+			break;
+		}
+	}
+#endif
+
+exit:
+
+	if ( loop != NULL )
+	{
+		loop->inProgress = NULL;
+	}
+
+	anioCurrentLoop = previousLoop;
+	
+	return result;
+}
+
+
+
+
+#if TARGET_OS_UNIXLIKE && !ASYNC_NETIO_USE_SELECT
+
+// the threads we start never take signals -- anything sent to the process goes to a thread that's
+//	expecting it, or to a signal monitor, and not to a worker that would just die of it
+static int	AsyncIO_CreateThread( pthread_t *outThread, void * (*function)( void * ), void * arg )
+{
+	sigset_t all, previous;
+	int err;
+
+	sigfillset( &all );
+	pthread_sigmask( SIG_SETMASK, &all, &previous );
+	err = pthread_create( outThread, NULL, function, arg );
+	pthread_sigmask( SIG_SETMASK, &previous, NULL );
+
+	return err;
+}
+
+#endif
+
+#if TARGET_OS_UNIXLIKE && !ASYNC_NETIO_USE_SELECT
+
+// one listening socket, loop and thread per shard -- SO_REUSEPORT lets the kernel spread
+//	incoming connections across the shards, so accepting scales with the number of threads
+
+typedef struct
+{
+	AsyncIOLoop		loop;
+	AsyncIO			listener;
+	pthread_t		thread;
+	bool			threadStarted;
+} AsyncIOListenerShard;
+
+typedef struct OpaqueAsyncIOShardedListener
+{
+	int						numShards;
+	AsyncIOListenerShard	shards[];
+} OpaqueAsyncIOShardedListener;
+
+static void * AsyncIO_ListenerShardThread( void * arg )
+{
+	AsyncIOListenerShard *shard = (AsyncIOListenerShard*)arg;
+	int err;
+
+	// runs until AsyncIO_ReleaseShardedListener() stops it
+	err = AsyncIOLoop_Run( shard->loop, true );
+	if ( err != 0 ) { dlog( kDebugLevelError, "AsyncIO: listener shard loop exited (%d)\n", errno ); }
+
+	return NULL;
+}
+
+static int AsyncIO_NewListenerShardSocket( const struct sockaddr *addr, socklen_t addrLen, int backlog )
+{
+	int result = kInvalidFD;
+	int fd, err, on = 1;
+
+	fd = socket( addr->sa_family, SOCK_STREAM, 0 );
+	require( fd >= 0, exit );
+
+	fcntl( fd, F_SETFD, FD_CLOEXEC );
+
+	err = setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof( on ) );
+	require( err == 0, exit );
+
+#ifdef SO_REUSEPORT_LB
+	// FreeBSD only balances connections across sockets with this one
+	err = setsockopt( fd, SOL_SOCKET, SO_REUSEPORT_LB, &on, sizeof( on ) );
 #else
-	ctx->num = kevent( anioKQ, NULL, 0, ctx->kv, kMaxAsyncIOEvents, to );
-#endif
+	err = setsockopt( fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof( on ) );
 #endif
+	require( err == 0, exit );
 
-	result = 0;
+	err = bind( fd, addr, addrLen );
+	if ( err != 0 ) { dlog( kDebugLevelError, "AsyncIO: listener shard bind error %d\n", errno ); }
+	require_quiet( err == 0, exit );
+
+	err = listen( fd, backlog );
+	require( err == 0, exit );
+
+	result = fd;
+	fd = kInvalidFD;
 
 exit:
 
+	ForgetFD( &fd );
+
 	return result;
 }
 
-int				AsyncIO_ProcessEvents( AsyncIOEventsContext inEventsContext )
+AsyncIOShardedListener	AsyncIO_NewShardedListener( const struct sockaddr *addr, socklen_t addrLen, int backlog, int numShards, AsyncIOEvent eventCallback, void * userData )
 {
-	int result = -1;
-	AsyncIOEventsContext ctx = inEventsContext;
-	
-	require( inEventsContext != NULL, exit );
+	AsyncIOShardedListener result = NULL, listener = NULL;
+	struct sockaddr_storage bound;
+	socklen_t boundLen;
+	int i, fd, err;
 
-#if ASYNC_NETIO_USE_SELECT
+	require( ( addr != NULL ) && ( addrLen <= sizeof( bound ) ), exit );
 
-	if ( ctx->num == 0 )
+	if ( numShards <= 0 )
 	{
-		// timeout reached
-		if ( aio_next_enabled_timer != NULL )
-		{
-			AsyncIO anio = aio_next_enabled_timer;
-
-			// we don't do multishot timers, so we want to remove this one from the list
-			AsyncIO_DisableTimer( anio );
-			anioInProgress = anio;
-			(*(anio->callback))( kAIO_TIMER_FIRED, anio, -1, anio->userdata );
-			anioInProgress = NULL;
-		}
-		else
-		{
-			// I'm not certain this can happen, but I'm gonna check it just in case
-			dlog( kDebugLevelTrace, "AsyncIO: timer fired, but has been disabled/deleted since priming\n" );
-		}
+		numShards = (int)sysconf( _SC_NPROCESSORS_ONLN );
+		numShards = Maximum( numShards, 1 );
 	}
-	else if ( ctx->num > 0 )
-	{
-		for ( i = 0; i <= ctx->maxFd; i++ )
-		{
-			if ( ctx->num == 0 )
-				break;
 
-			if ( FD_ISSET( i, &ctx->readfds ) )
-			{
-				ctx->num--;
+	listener = calloc( 1, sizeof( OpaqueAsyncIOShardedListener ) + ( numShards * sizeof( AsyncIOListenerShard ) ) );
+	require( listener != NULL, exit );
 
-				AsyncIO anio;
-				lwip_socket_get_userdata( i, (void**)&anio );
+	listener->numShards = numShards;
 
-				// clear it before call back, because they may request it again DURING the callback
-				FD_CLR( i, &anioReadSet );
+	memcpy( &bound, addr, addrLen );
+	boundLen = addrLen;
 
-				anioInProgress = anio;
-				if ( anio->type == kAIO_TYPE_LISTENER )
-					(*(anio->callback))( kAIO_NEW_CONNECTION, anio, anio->fd, anio->userdata );
-				else if ( anio->type == kAIO_TYPE_CONNECTION )
-				{
-					anio->notifyOnRead = false;
-					(*(anio->callback))( kAIO_DATA_AVAILABLE, anio, anio->fd, anio->userdata );
-				}
-				anioInProgress = NULL;
-			}
+	for ( i = 0; i < numShards; i++ )
+	{
+		AsyncIOListenerShard *shard = &listener->shards[i];
 
-			if ( FD_ISSET( i, &ctx->writefds ) )
-			{
-				num--;
+		fd = AsyncIO_NewListenerShardSocket( (struct sockaddr*)&bound, boundLen, backlog );
+		require_quiet( fd >= 0, exit );
 
-				AsyncIO anio;
-				lwip_socket_get_userdata( i, (void**)&anio );
+		// if they asked for any port, the rest of the shards need the one the first one got
+		if ( i == 0 )
+		{
+			boundLen = sizeof( bound );
+			err = getsockname( fd, (struct sockaddr*)&bound, &boundLen );
+			require_action( err == 0, exit, close( fd ) );
+		}
 
-				// clear it before call back, because they may request it again DURING the callback
-				FD_CLR( i, &anioWriteSet );
+		shard->loop = AsyncIOLoop_Create();
+		require_action( shard->loop != NULL, exit, close( fd ) );
 
-				anioInProgress = anio;
-				anio->notifyOnWrite = false;
-				(*(anio->callback))( kAIO_READY_FOR_WRITE, anio, anio->fd, anio->userdata );
-				anioInProgress = NULL;
-			}
-		}
+		AsyncIOLoop previous = AsyncIOLoop_SetCurrent( shard->loop );
+		shard->listener = AsyncIO_NewConnectionListener( fd, eventCallback, userData );
+		AsyncIOLoop_SetCurrent( previous );
+		require_action( shard->listener != NULL, exit, close( fd ) );
+	}
 
-		check( ctx->num == 0 );
+	for ( i = 0; i < numShards; i++ )
+	{
+		AsyncIOListenerShard *shard = &listener->shards[i];
+
+		err = AsyncIO_CreateThread( &shard->thread, AsyncIO_ListenerShardThread, shard );
+		require( err == 0, exit );
+
+		shard->threadStarted = true;
 	}
-#endif
 
-#if ASYNC_NETIO_USE_KQUEUE
+	result = listener;
+	listener = NULL;
 
-	AsyncIO anio;
-	int ident;
+exit:
 
-	int i;
-	for ( i = 0; i < ctx->num; i++ )
+	if ( listener != NULL )
 	{
-		anio = (AsyncIO)ctx->kv[i].udata;
-		anioInProgress = anio;
-
-		switch ( ctx->kv[i].filter )
-		{
-			case EVFILT_READ:
-				{
-					ident = (int)ctx->kv[i].ident;
-					if ( anio->type == kAIO_TYPE_LISTENER )
-						(*(anio->callback))( kAIO_NEW_CONNECTION, anio, ident, anio->userdata );
-					else if ( anio->type == kAIO_TYPE_CONNECTION )
-					{
-						anio->notifyOnRead = false;
-						(*(anio->callback))( kAIO_DATA_AVAILABLE, anio, ident, anio->userdata );
-					}
-				}
-				break;
+		AsyncIO_ReleaseShardedListener( listener );
+	}
 
-			case EVFILT_WRITE:
-				{
-					ident = (int)ctx->kv[i].ident;
-					anio->notifyOnWrite = false;
-					(*(anio->callback))( kAIO_READY_FOR_WRITE, anio, ident, anio->userdata );
-				}
-				break;
+	return result;
+}
 
-			case EVFILT_TIMER:
-				{
-					(*(anio->callback))(kAIO_TIMER_FIRED, anio, -1, anio->userdata );
-				}
-				break;
+void AsyncIO_ReleaseShardedListener( AsyncIOShardedListener listener )
+{
+	int i;
 
-			case EVFILT_PROC:
-				{
-					ident = (int)ctx->kv[i].ident;
-					(*(anio->callback))(kAIO_PROCESS_EXITED, anio, ident, anio->userdata );
-				}
-				break;
+	require( listener != NULL, exit );
 
-			case EVFILT_SIGNAL:
-				{
-					ident = (int)ctx->kv[i].ident;
-					(*(anio->callback))(kAIO_SIGNAL_DELIVERED, anio, ident, anio->userdata );
-				}
-		}
+	for ( i = 0; i < listener->numShards; i++ )
+	{
+		AsyncIOListenerShard *shard = &listener->shards[i];
 
-		if ( ctx->kv[i].flags & EV_EOF )
+		if ( shard->threadStarted )
 		{
-			//check( kv.filter == EVFILT_READ );
-			if ( ctx->kv[i].filter == EVFILT_READ )
-			{
-				// adding log message - can't remember if this works...
-				dlog( kDebugLevelChatty, "kevent: EV_EOF hit\n" );
-
-				require_continue_quiet( anioInProgress == anio );	// make sure it didn't get freed
+			AsyncIOLoop_Stop( shard->loop );
+			pthread_join( shard->thread, NULL );
+			shard->threadStarted = false;
+		}
+	}
 
-				ident = (int)ctx->kv[i].ident;
+	// the threads are gone, so it's safe to tear down their loops from here
+	for ( i = 0; i < listener->numShards; i++ )
+	{
+		AsyncIOListenerShard *shard = &listener->shards[i];
 
-				// let them know the socket closed
-				(*(anio->callback))( kAIO_CONNECTION_CLOSED, anio, ident, anio->userdata );
-			}
-			else
-			{
-				// why do we get these?
-			}
-		}
-		
-		anioInProgress = NULL;
+		ForgetAsyncIO( &shard->listener, true );
+		ForgetAsyncIOLoop( &shard->loop );
 	}
-	#endif
 
-	result = 0;
+	ForgetMem( &listener );
 
 exit:
-
-	return result;
+	;
 }
 
+#endif
+
 
 
+#if TARGET_OS_UNIXLIKE && !ASYNC_NETIO_USE_SELECT
 
-int AsyncIO_Run( bool keepRunning )
+// AsyncIO_Offload() -- one process-wide pool of worker threads, started as they're needed (up to
+//	the limit) and kept around after that.  the work runs on a worker, and the completion gets
+//	posted back to the loop that asked for it.
+#define kAsyncIODefaultOffloadThreads		4
+
+typedef struct AsyncIOOffloadJob
 {
-	int result = -1;
+	AsyncIOTask					post;			// first -- the completion goes back on it, so that can't fail
+	struct AsyncIOOffloadJob	*next;
+	AsyncIOLoop					loop;
+	AsyncIOTaskFunction			work;
+	AsyncIOTaskFunction			done;
+	void*						context;
+} AsyncIOOffloadJob;
+
+static pthread_mutex_t		anioOffloadLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		anioOffloadReady = PTHREAD_COND_INITIALIZER;
+static AsyncIOOffloadJob	*anioOffloadHead = NULL;
+static AsyncIOOffloadJob	*anioOffloadTail = NULL;
+static int					anioOffloadThreads = 0;
+static int					anioOffloadIdle = 0;
+static int					anioOffloadQueued = 0;
+static int					anioOffloadMaxThreads = kAsyncIODefaultOffloadThreads;
+
+// back on the loop's thread
+static void AsyncIO_OffloadDone( void * context )
+{
+	AsyncIOOffloadJob *job = (AsyncIOOffloadJob*)context;
+
+	__atomic_sub_fetch( &job->loop->offloadsPending, 1, __ATOMIC_RELEASE );
 
-#if THRASH_DETECTION
-	runs++;
-	if ( !tvStartTimeValid )
+	if ( job->done != NULL )
 	{
-		gettimeofday( &tvStart, NULL );
+		(*(job->done))( job->context );
 	}
 
-#if 1
-	gettimeofday( &tvEnd, NULL );
-	if ( tvEnd.tv_sec - tvStart.tv_sec >= 2 )
+	// the job is its own task, and goes when this returns
+}
+
+static void * AsyncIO_OffloadThread( void * arg )
+{
+	AsyncIOOffloadJob *job;
+
+	(void)arg;
+
+	pthread_mutex_lock( &anioOffloadLock );
+
+	for ( ;; )
 	{
-		if ( ( tvEnd.tv_sec - tvStart.tv_sec == 2 ) && ( runs > 1000 ) )
+		while ( anioOffloadHead == NULL )
 		{
-			dlog( kDebugLevelMax, "AsyncIO_Run: thrashing?\n" );
-			sleep( 1 );
+			anioOffloadIdle++;
+			pthread_cond_wait( &anioOffloadReady, &anioOffloadLock );
+			anioOffloadIdle--;
 		}
-		runs = 0;
-		gettimeofday( &tvStart, NULL );
-	}
-#else
-	if ( runs > 1000 )
-	{
-		gettimeofday( &tvEnd, NULL );
-		if ( tvEnd.tv_sec - tvStart.tv_sec <= 2 )
+
+		job = anioOffloadHead;
+		anioOffloadQueued--;
+		anioOffloadHead = job->next;
+		if ( anioOffloadHead == NULL )
 		{
-			dlog( kDebugLevelMax, "AsyncIO_Run: thrashing?\n" );
-			sleep( 1 );
+			anioOffloadTail = NULL;
 		}
-	}
-#endif
-#endif
 
+		pthread_mutex_unlock( &anioOffloadLock );
 
-	check( anioInProgress == NULL );
+		(*(job->work))( job->context );
 
-#if TARGET_OS_FREERTOS
-	UBaseType_t stackFreeNow, stackFree = uxTaskGetStackHighWaterMark( NULL );
+		job->post.function = AsyncIO_OffloadDone;
+		job->post.context = job;
+		AsyncIOLoop_PostTask( job->loop, &job->post );
 
-	if ( keepRunning )
-	{
-		dlog( kDebugLevelTrace, "AsyncIO_Run: current stack low water mark is %lu\n", (unsigned long)stackFree );
+		pthread_mutex_lock( &anioOffloadLock );
 	}
-#endif
 
-#if ASYNC_NETIO_USE_SELECT
+	return NULL;
+}
 
-	// take a look at <https://www.freertos.org/Pend-on-multiple-rtos-objects.html>
-	// see if it's possible to have other objects we could wait on, inside the lwip select (we might need to have it call back to us)
+int				AsyncIO_SetOffloadThreads( int maxThreads )
+{
+	int result = -1;
 
-#warning "FIX ME: select case never posts kAIO_CONNECTION_CLOSED events for read"
-	// we don't handle the EV_EOF case
+	require( maxThreads > 0, exit );
 
-	fd_set	readfds;
-	fd_set	writefds;
-	int		maxFd;
+	// takes effect as threads are needed -- there's no shrinking the ones already running
+	pthread_mutex_lock( &anioOffloadLock );
+	anioOffloadMaxThreads = maxThreads;
+	pthread_mutex_unlock( &anioOffloadLock );
 
-	while ( 1 )
-	{
-		int i;
-		struct timeval timeout;
-		struct timeval *to;
+	result = 0;
 
-		FD_ZERO( &readfds );
-		FD_ZERO( &writefds );
-		maxFd = -1;
-		for ( i = 0; i < LWIP_SELECT_MAXNFDS; i++ )
-		{
-			if ( FD_ISSET( i, &anioReadSet ) )
-			{
-				maxFd = i;
-				FD_SET( i, &readfds );
-			}
-			if ( FD_ISSET( i, &anioWriteSet ) )
-			{
-				maxFd = i;
-				FD_SET( i, &writefds );
-			}
-		}
+exit:
 
-		// if there's nothing to monitor, we can't do anything here
-		//require( maxFd != -1, exit );
-		
-		#warning "FIX ME: we need to know when the next timer will fire"
-#if 1
-		to = NULL;
-		aio_next_enabled_timer = NULL;
-		AsyncIO_GetNextTimerFireTime( &timeout, &aio_next_enabled_timer );
-		if ( aio_next_enabled_timer != NULL )
-		{
-			to = &timeout;
-		}
-#else
-		timeout.tv_sec = 0;
-		timeout.tv_usec = 0;
-		to = NULL;
-		if (!keepRunning )
-		{
-			to = &timeout;
-		}
-#endif
+	return result;
+}
 
-		require( ( maxFd >= 0 ) || ( to != NULL ), exit );
-		int num;
+int				AsyncIO_Offload( AsyncIOTaskFunction work, AsyncIOTaskFunction done, void * context )
+{
+	int result = -1;
+	AsyncIOOffloadJob *job = NULL;
+	AsyncIOLoop loop = AsyncIO_CurrentLoop();
+	pthread_t thread;
+	int err;
 
-//if ( log_aio_hap_failed ) { dlog( kDebugLevelMax, "hap: AsyncIO_Run\n" ); }
+	require( work != NULL, exit );
+	require( loop != NULL, exit );
 
+	job = calloc( 1, sizeof( AsyncIOOffloadJob ) );
+	require( job != NULL, exit );
 
+	job->loop = loop;
+	job->work = work;
+	job->done = done;
+	job->context = context;
 
-		if ( maxFd == -1 )
+	__atomic_add_fetch( &loop->offloadsPending, 1, __ATOMIC_RELAXED );
+
+	pthread_mutex_lock( &anioOffloadLock );
+
+	if ( anioOffloadTail != NULL )
+		anioOffloadTail->next = job;
+	else
+		anioOffloadHead = job;
+	anioOffloadTail = job;
+	anioOffloadQueued++;
+
+	// nobody's free to pick it up, so start another worker if we're allowed to -- otherwise it
+	//	waits its turn
+	if ( ( anioOffloadQueued > anioOffloadIdle ) && ( anioOffloadThreads < anioOffloadMaxThreads ) )
+	{
+		err = AsyncIO_CreateThread( &thread, AsyncIO_OffloadThread, NULL );
+		if ( err == 0 )
 		{
-			num = select( 0, NULL, NULL, NULL, to );
+			pthread_detach( thread );
+			anioOffloadThreads++;
 		}
 		else
 		{
-			num = select( maxFd+1, &readfds, &writefds, NULL, to );
-		}
-
-		if ( num == 0 )
-		{
-			// timeout reached
-			if ( aio_next_enabled_timer != NULL )
-			{
-				AsyncIO anio = aio_next_enabled_timer;
-
-				// we don't do multishot timers, so we want to remove this one from the list
-				AsyncIO_DisableTimer( anio );
-				anioInProgress = anio;
-				(*(anio->callback))( kAIO_TIMER_FIRED, anio, -1, anio->userdata );
-				anioInProgress = NULL;
-			}
-			else
-			{
-				// I'm not certain this can happen, but I'm gonna check it just in case
-				dlog( kDebugLevelTrace, "AsyncIO: timer fired, but has been disabled/deleted since priming\n" );
-			}
+			dlog( kDebugLevelError, "AsyncIO: couldn't start an offload thread (%d)\n", err );
 		}
-		else if ( num > 0 )
-		{
-			for ( i = 0; i <= maxFd; i++ )
-			{
-				if ( num == 0 )
-					break;
-
-				if ( FD_ISSET( i, &readfds ) )
-				{
-					num--;
+	}
 
-					AsyncIO anio;
-					lwip_socket_get_userdata( i, (void**)&anio );
+	// can't have the job with nobody to run it
+	err = ( anioOffloadThreads > 0 ) ? 0 : -1;
+	if ( err == 0 )
+	{
+		pthread_cond_signal( &anioOffloadReady );
+	}
+	else
+	{
+		anioOffloadHead = anioOffloadTail = NULL;
+		anioOffloadQueued = 0;
+	}
 
-					// clear it before call back, because they may request it again DURING the callback
-					FD_CLR( i, &anioReadSet );
+	pthread_mutex_unlock( &anioOffloadLock );
 
-					anioInProgress = anio;
-					if ( anio->type == kAIO_TYPE_LISTENER )
-						(*(anio->callback))( kAIO_NEW_CONNECTION, anio, anio->fd, anio->userdata );
-					else if ( anio->type == kAIO_TYPE_CONNECTION )
-					{
-						anio->notifyOnRead = false;
-						(*(anio->callback))( kAIO_DATA_AVAILABLE, anio, anio->fd, anio->userdata );
-					}
-					anioInProgress = NULL;
-				}
+	if ( err != 0 )
+	{
+		__atomic_sub_fetch( &loop->offloadsPending, 1, __ATOMIC_RELEASE );
+		ForgetMem( &job );
+	}
+	require_quiet( err == 0, exit );
 
-				if ( FD_ISSET( i, &writefds ) )
-				{
-					num--;
+	result = 0;
 
-					AsyncIO anio;
-					lwip_socket_get_userdata( i, (void**)&anio );
+exit:
 
-					// clear it before call back, because they may request it again DURING the callback
-					FD_CLR( i, &anioWriteSet );
+	return result;
+}
 
-					anioInProgress = anio;
-					anio->notifyOnWrite = false;
-					(*(anio->callback))( kAIO_READY_FOR_WRITE, anio, anio->fd, anio->userdata );
-					anioInProgress = NULL;
-				}
-			}
+// AsyncIO_ReadFile/WriteFile -- regular files are always "ready", so there's nothing to wait on;
+//	the transfer itself has to happen somewhere else.  that's the kernel with io_uring, and the
+//	offload pool otherwise (or if the ring's full, or its kernel doesn't do plain reads and writes)
+struct AsyncIOFileOp
+{
+	AsyncIOLoop					loop;
+	int							fd;
+	bool						write;
+	uint8_t						*buffer;
+	size_t						length;
+	off_t						offset;
+	size_t						transferred;
+	int							err;
+	AsyncIOFileCompletion		completion;
+	void*						userData;
+};
 
-			check( num == 0 );
-		}
+// on a worker -- all of it, unless it fails or the file ends first
+static void AsyncIO_FileOpWork( void * context )
+{
+	AsyncIOFileOp *op = (AsyncIOFileOp*)context;
+	ssize_t num;
+
+	while ( op->transferred < op->length )
+	{
+		if ( op->write )
+			num = pwrite( op->fd, op->buffer + op->transferred, op->length - op->transferred, op->offset + op->transferred );
 		else
+			num = pread( op->fd, op->buffer + op->transferred, op->length - op->transferred, op->offset + op->transferred );
+
+		if ( num < 0 )
 		{
-			dlog( kDebugLevelTrace, "AsyncIO_Run: select returned %d (error = %d)\r\n", num, errno );
+			if ( errno == EINTR )
+				continue;
+
+			op->err = errno;
 			break;
 		}
 
-		if ( !keepRunning )
+		if ( num == 0 )
 			break;
 
-#if TARGET_OS_FREERTOS
-		stackFreeNow = uxTaskGetStackHighWaterMark( NULL );
-		if ( stackFreeNow < stackFree )
-		{
-			stackFree = stackFreeNow;
-			dlog( kDebugLevelTrace, "AsyncIO_Run: current stack low water mark is now %lu\n", (unsigned long)stackFree );
-		}
-#endif
+		op->transferred += (size_t)num;
 	}
-#endif
+}
 
-#if ASYNC_NETIO_USE_KQUEUE
-	AsyncIO		anio;
-	struct timespec	*to;
-	struct timespec timeout;
-#ifdef EV_SET64
-	struct kevent64_s	kv;
-#else
-	struct kevent		kv;
-#endif
-	bool	got_first_event;
+static void AsyncIO_FileOpDone( void * context )
+{
+	AsyncIOFileOp *op = (AsyncIOFileOp*)context;
 
+	(*(op->completion))( op->fd, (ssize_t)op->transferred, op->err, op->userData );
+	ForgetMem( &op );
+}
 
-	got_first_event = false;
-	while ( true )
-	{
-		int ident;
-		int num;
-		
-		timeout.tv_sec = 0;
-		timeout.tv_nsec = 0;
-		to = NULL;
-		// for the first event, we always use a NULL timeout...
-		if ( ( !keepRunning ) && ( got_first_event ) )
-			to = &timeout;
-		errno = 0;
-#ifdef EV_SET64
-		num = kevent64( anioKQ, NULL, 0, &kv, 1, 0, to );
-#else
-		num = kevent( anioKQ, NULL, 0, &kv, 1, to );
-#endif
-		if ( ( num == 0 ) && ( !keepRunning ) )
-		{
-			result = 0;
-			break;
-		}
-		if ( num != 1 ) { dlog( kDebugLevelError, "AsyncIO: kevent result %d (error %d)\n", num, errno ); }
-#if __APPLE__
-		if ( ( num != 1 ) && ( errno == EINTR ) && ( debug_running_in_debugger() ) ) { dlog( kDebugLevelTrace, "AsyncIO: kevent signal in debugger, likely breakpoint, ignoring\n" ); continue; }
-#endif
-		require_quiet( num == 1, exit );
-		got_first_event = true;
+static int AsyncIO_OffloadFileOp( AsyncIOFileOp *op )
+{
+	AsyncIOLoop previous = AsyncIOLoop_SetCurrent( op->loop );
+	int err = AsyncIO_Offload( AsyncIO_FileOpWork, AsyncIO_FileOpDone, op );
 
-		anio = (AsyncIO)kv.udata;
-		anioInProgress = anio;
+	AsyncIOLoop_SetCurrent( previous );
 
+	return err;
+}
 
-		switch ( kv.filter )
-		{
-			case EVFILT_READ:
-				{
-					ident = (int)kv.ident;
-					if ( anio->type == kAIO_TYPE_LISTENER )
-						(*(anio->callback))( kAIO_NEW_CONNECTION, anio, ident, anio->userdata );
-					else if ( anio->type == kAIO_TYPE_CONNECTION )
-					{
-						anio->notifyOnRead = false;
-						(*(anio->callback))( kAIO_DATA_AVAILABLE, anio, ident, anio->userdata );
-					}
-				}
-				break;
+#if ASYNC_NETIO_USE_IO_URING
+// not fixed buffers (they're the caller's), and the offset is a real one
+static int AsyncIO_URingQueueFileOp( AsyncIOLoop loop, AsyncIOFileOp *op )
+{
+	int result = -1;
+	struct io_uring_sqe *sqe;
 
-			case EVFILT_WRITE:
-				{
-					ident = (int)kv.ident;
-					anio->notifyOnWrite = false;
-					(*(anio->callback))( kAIO_READY_FOR_WRITE, anio, ident, anio->userdata );
-				}
-				break;
+	sqe = AsyncIO_URingGetSQE( loop );
+	require_quiet( sqe != NULL, exit );
 
-			case EVFILT_TIMER:
-				{
-					(*(anio->callback))(kAIO_TIMER_FIRED, anio, -1, anio->userdata );
-				}
-				break;
+	sqe->opcode = op->write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = op->fd;
+	sqe->addr = (uint64_t)(uintptr_t)( op->buffer + op->transferred );
+	sqe->len = (uint32_t)Minimum( op->length - op->transferred, (size_t)INT32_MAX );
+	sqe->off = (uint64_t)( op->offset + op->transferred );
+	sqe->user_data = (uint64_t)(uintptr_t)op;
 
-			case EVFILT_PROC:
-				{
-					ident = (int)kv.ident;
-					(*(anio->callback))(kAIO_PROCESS_EXITED, anio, ident, anio->userdata );
-				}
-				break;
+	result = 0;
 
-			case EVFILT_SIGNAL:
-				{
-					ident = (int)kv.ident;
-					(*(anio->callback))(kAIO_SIGNAL_DELIVERED, anio, ident, anio->userdata );
-				}
-		}
+exit:
 
-		if ( kv.flags & EV_EOF )
-		{
-			//check( kv.filter == EVFILT_READ );
-			if ( kv.filter == EVFILT_READ )
-			{
-				// adding log message - can't remember if this works...
-				dlog( kDebugLevelChatty, "kevent: EV_EOF hit\n" );
+	return result;
+}
+
+static void AsyncIO_URingCompleteFileOp( AsyncIOLoop loop, AsyncIOFileOp *op, int res )
+{
+	__atomic_sub_fetch( &loop->offloadsPending, 1, __ATOMIC_RELEASE );
+
+	if ( ( res == -EINTR ) || ( res == -EAGAIN ) )
+	{
+		// nothing moved -- again, on the ring if there's room for it, or else on the workers
+		if ( AsyncIO_URingQueueFileOp( loop, op ) == 0 )
+			goto requeued;
+		if ( AsyncIO_OffloadFileOp( op ) == 0 )
+			return;
+		op->err = ENOMEM;
+	}
+	else if ( res > 0 )
+	{
+		// keep going until it's all there, or the file ends
+		op->transferred += (size_t)res;
+		if ( ( op->transferred < op->length ) && ( AsyncIO_URingQueueFileOp( loop, op ) == 0 ) )
+			goto requeued;
+	}
+	else if ( res < 0 )
+	{
+		op->err = -res;
+	}
 
-				require_continue_quiet( anioInProgress == anio );	// make sure it didn't get freed
+	// an older kernel that doesn't know IORING_OP_READ/WRITE says EINVAL -- the workers will
+	//	say it again if it's something else
+	if ( ( op->err == EINVAL ) && ( op->transferred == 0 ) )
+	{
+		op->err = 0;
+		if ( AsyncIO_OffloadFileOp( op ) == 0 )
+			return;
+		op->err = EINVAL;
+	}
+	// there wasn't an sqe for the rest of it
+	else if ( ( op->err == 0 ) && ( res != 0 ) && ( op->transferred < op->length ) )
+	{
+		if ( AsyncIO_OffloadFileOp( op ) == 0 )
+			return;
+		op->err = ENOMEM;
+	}
 
-				ident = (int)kv.ident;
+	AsyncIO_FileOpDone( op );
+	return;
 
-				// let them know the socket closed
-				(*(anio->callback))( kAIO_CONNECTION_CLOSED, anio, ident, anio->userdata );
-			}
-			else
-			{
-				// why do we get these?
-			}
-		}
-		
-		anioInProgress = NULL;
+requeued:
+
+	__atomic_add_fetch( &loop->offloadsPending, 1, __ATOMIC_RELAXED );
+}
+#endif
+
+static int AsyncIO_StartFileOp( int fd, bool write, void * buffer, size_t length, off_t offset, AsyncIOFileCompletion completion, void * userData )
+{
+	int result = -1;
+	AsyncIOFileOp *op = NULL;
+	AsyncIOLoop loop = AsyncIO_CurrentLoop();
+
+	require_action( ( fd >= 0 ) && ( offset >= 0 ) && ( completion != NULL ), exit, errno = EINVAL );
+	require_action( ( buffer != NULL ) || ( length == 0 ), exit, errno = EINVAL );
+	require_action( loop != NULL, exit, errno = EINVAL );
+
+	op = calloc( 1, sizeof( AsyncIOFileOp ) );
+	require_action( op != NULL, exit, errno = ENOMEM );
+
+	op->loop = loop;
+	op->fd = fd;
+	op->write = write;
+	op->buffer = buffer;
+	op->length = length;
+	op->offset = offset;
+	op->completion = completion;
+	op->userData = userData;
+
+#if ASYNC_NETIO_USE_IO_URING
+	// goes to the kernel with everything else, right before the loop waits
+	if ( ( AsyncIO_URingInitialize( loop ) == 0 ) && ( AsyncIO_URingQueueFileOp( loop, op ) == 0 ) )
+	{
+		__atomic_add_fetch( &loop->offloadsPending, 1, __ATOMIC_RELAXED );
+		op = NULL;
 	}
 #endif
 
+	if ( op != NULL )
+	{
+		require_action_quiet( AsyncIO_OffloadFileOp( op ) == 0, exit, errno = ENOMEM );
+		op = NULL;
+	}
+
+	result = 0;
+
 exit:
 
-	anioInProgress = NULL;
-	
+	ForgetMem( &op );
+
 	return result;
 }
 
+int				AsyncIO_ReadFile( int fd, void * buffer, size_t length, off_t offset, AsyncIOFileCompletion completion, void * userData )
+{
+	return AsyncIO_StartFileOp( fd, false, buffer, length, offset, completion, userData );
+}
+
+int				AsyncIO_WriteFile( int fd, const void * buffer, size_t length, off_t offset, AsyncIOFileCompletion completion, void * userData )
+{
+	return AsyncIO_StartFileOp( fd, true, (void*)buffer, length, offset, completion, userData );
+}
 
+#endif
 
 
 // when input is closed, we close the output? unless flag is set?
 
-#define REDIR_STATE_WAITING_FOR_DATA	1
-#define REDIR_STATE_SENDING				2
-//#define REDIR_STATE_WAITING_TO_SEND		3
+// data sits in a ring (or, when splicing, our pipe) between the two sides, so reading carries on
+//	while the output drains -- until it's above the high watermark, and then input waits until
+//	it's back down to the low one
+#define kRedirectDefaultBufferSize		65536
+
+#if TARGET_OS_LINUX
+// how much we ask splice() to move at once -- it's really limited by the pipe's capacity
+#define kRedirectSpliceChunk			65536
+#endif
 
 typedef struct OpaqueAsyncIORedirect
 {
-	int 		state;
-
-	//int fd_in;
-	//int fd_out;
 	const char * label;
 
 	int			fd_in;
 	AsyncIO 	anio_in;
-	//bool		read_pending;
+	bool		read_pending;
+	bool		input_paused;			// above the high watermark
+	bool		input_done;				// EOF or an error
 
 	int			fd_out;
-	AsyncIO	anio_out;
-	//bool		write_pending;
-
-	char		buffer[512];
-	size_t		num_in_buffer;
+	AsyncIO		anio_out;
+	bool		write_pending;
+	bool		output_failed;
+
+	AsyncIORing	ring;
+	size_t		num_in_buffer;			// when splicing, it's what's sitting in the pipe
+	size_t		capacity;
+	size_t		high_water;
+	size_t		low_water;
+	size_t		high_water_asked;		// as given, so they can be worked out again if capacity changes
+	size_t		low_water_asked;
+
+#if TARGET_OS_LINUX
+	// on Linux, data goes from fd_in to fd_out through a pipe of our own with splice(), so it never
+	//	gets copied up into the ring
+	bool		splicing;
+	int			pipe_read;
+	int			pipe_write;
+#endif
 
 	AsyncRedirectIOEvent	callback;
 	void*					callback_data;
 
 } OpaqueAsyncIORedirect;
 
+#if TARGET_OS_LINUX
+// splice() needs one side of every call to be a pipe, and the other to be something that supports it
+static bool redirect_CanSplice( int fd )
+{
+	struct stat sb;
+
+	if ( fstat( fd, &sb ) != 0 )
+		return false;
+
+	return S_ISSOCK( sb.st_mode ) || S_ISFIFO( sb.st_mode ) || S_ISREG( sb.st_mode );
+}
+#endif
+
+static void redirect_SetWatermarks( AsyncRedirectIO redir, size_t lowWater, size_t highWater );
+
+// bytes read, 0 at EOF, or -1 with errno set (ENOBUFS when there's no room to read into)
+static ssize_t redirect_Fill( AsyncRedirectIO redir )
+{
+	struct iovec iov[2];
+	ssize_t num_in;
+	int num;
+
+#if TARGET_OS_LINUX
+	if ( redir->splicing )
+	{
+		num_in = splice( redir->fd_in, NULL, redir->pipe_write, NULL, Minimum( kRedirectSpliceChunk, ( redir->capacity - redir->num_in_buffer ) ), SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+		if ( ( num_in >= 0 ) || ( errno != EINVAL ) || ( redir->num_in_buffer != 0 ) )
+			return num_in;
+
+		// the pipe's empty, so nothing's lost by going back to copying
+		dlog( kDebugLevelChatty, "AsyncIORedirect: can't splice, copying instead\n" );
+		redir->splicing = false;
+		redir->capacity = redir->ring.size;
+		redirect_SetWatermarks( redir, redir->low_water_asked, redir->high_water_asked );
+	}
+#endif
+
+	// (a read into nothing would look like EOF)
+	num = AsyncIO_RingFreeSpans( &redir->ring, iov );
+	if ( num == 0 )
+	{
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	num_in = readv( redir->fd_in, iov, num );
+	if ( num_in > 0 )
+	{
+		redir->ring.count += num_in;
+	}
+
+	return num_in;
+}
+
+// bytes written, or -1 with errno set
+static ssize_t redirect_Drain( AsyncRedirectIO redir )
+{
+	struct iovec iov[2];
+	ssize_t num_out;
+	int num;
+
+#if TARGET_OS_LINUX
+	if ( redir->splicing )
+	{
+		return splice( redir->pipe_read, NULL, redir->fd_out, NULL, redir->num_in_buffer, SPLICE_F_MOVE | SPLICE_F_NONBLOCK );
+	}
+#endif
+
+	// a short write just moves the head -- nothing to shuffle around
+	num = AsyncIO_RingSpans( &redir->ring, iov );
+	num_out = writev( redir->fd_out, iov, num );
+	if ( num_out > 0 )
+	{
+		AsyncIO_RingConsume( &redir->ring, num_out );
+	}
+
+	return num_out;
+}
+
 static void redirect_Pump( AsyncRedirectIO redir )
 {
-	bool	done = false;
+	bool	progress = true;
 
-	while ( !done )
+	while ( progress )
 	{
-		switch ( redir->state )
+		progress = false;
+
+		if ( !redir->input_done && !redir->input_paused && !redir->read_pending )
 		{
-			case REDIR_STATE_WAITING_FOR_DATA:
-				{
-					ssize_t num_in;
+			ssize_t num_in = redirect_Fill( redir );
 
-					num_in = read( redir->fd_in, redir->buffer, sizeof( redir->buffer ) );
-					if ( num_in < 0 )
-					{
-						if ( errno == EWOULDBLOCK )
-						{
-							AsyncIO_NotifyOnReadability( redir->anio_in );
-							done = true;
-							break;
-						}
+			if ( num_in > 0 )
+			{
+				redir->num_in_buffer += num_in;
+				progress = true;
 
-						dlog( kDebugLevelError, "AsyncIORedirect: error reading from input (%d)\n", errno );
-						(redir->callback)( kAIO_REDIRECT_INPUT_ERROR_EVENT, redir, redir->callback_data );
-					}
-					else if ( num_in == 0 )
-					{
-						dlog( kDebugLevelChatty, "AsyncIORedirect: zero-length read from input (closed?)\n" );
-						done = true;
-						break;
-					}
-					else
-					{
-						redir->num_in_buffer = num_in;
-						redir->state = REDIR_STATE_SENDING;
-					}
+				if ( redir->num_in_buffer >= redir->high_water )
+				{
+					redir->input_paused = true;
 				}
-				break;
-
-			case REDIR_STATE_SENDING:
+			}
+			else if ( num_in == 0 )
+			{
+				dlog( kDebugLevelChatty, "AsyncIORedirect: zero-length read from input (closed?)\n" );
+				redir->input_done = true;
+			}
+			else if ( errno == ENOBUFS )
+			{
+				// full -- the output side lets it go again once it's drained to the low watermark
+				redir->input_paused = true;
+			}
+			else if ( ( errno == EWOULDBLOCK ) || ( errno == EAGAIN ) )
+			{
+#if TARGET_OS_LINUX
+				// that might just be the pipe filling up (it counts in pages, not bytes) -- and if
+				//	there's anything in it, the output side is waiting, and will bring us back here
+				if ( !redir->splicing || ( redir->num_in_buffer == 0 ) )
+#endif
 				{
-					ssize_t num_out = write( redir->fd_out, redir->buffer, redir->num_in_buffer );
-
-					if ( num_out < 0 )
-					{
-						if ( ( errno == EWOULDBLOCK ) || ( errno == EAGAIN ) )
-						{
-							//redir->state = REDIR_STATE_WAITING_TO_SEND;
-							AsyncIO_NotifyOnWritability( redir->anio_out );
-							done = true;
-							break;
-						}
+					redir->read_pending = true;
+					AsyncIO_NotifyOnReadability( redir->anio_in );
+				}
+			}
+			else
+			{
+				dlog( kDebugLevelError, "AsyncIORedirect: error reading from input (%d)\n", errno );
+				redir->input_done = true;
+				(redir->callback)( kAIO_REDIRECT_INPUT_ERROR_EVENT, redir, redir->callback_data );
+			}
+		}
 
-						dlog( kDebugLevelError, "AsyncIORedirect: error writing to output (%d)\n", errno );
-						(redir->callback)( kAIO_REDIRECT_OUTPUT_ERROR_EVENT, redir, redir->callback_data );
-					}
-					else if ( num_out < redir->num_in_buffer )
-					{
-						// clear out anything we have
-						size_t remaining = redir->num_in_buffer - num_out;
-						memmove( redir->buffer, &redir->buffer[ num_out ], remaining );
+		if ( ( redir->num_in_buffer > 0 ) && !redir->output_failed && !redir->write_pending )
+		{
+			ssize_t num_out = redirect_Drain( redir );
 
-						// we'll try to send again
-					}
-					else
-					{
-						(redir->callback)( kAIO_REDIRECT_DATA_WRITTEN, redir, redir->callback_data );
+			if ( num_out > 0 )
+			{
+				redir->num_in_buffer -= num_out;
+				progress = true;
 
-						redir->state = REDIR_STATE_WAITING_FOR_DATA;
-					}
+				if ( redir->input_paused && ( redir->num_in_buffer <= redir->low_water ) )
+				{
+					redir->input_paused = false;
 				}
-				break;
 
-			default:
-				check( 0 );
-				break;
+				if ( redir->num_in_buffer == 0 )
+				{
+					(redir->callback)( kAIO_REDIRECT_DATA_WRITTEN, redir, redir->callback_data );
+				}
+			}
+			else if ( ( num_out < 0 ) && ( ( errno == EWOULDBLOCK ) || ( errno == EAGAIN ) ) )
+			{
+				redir->write_pending = true;
+				AsyncIO_NotifyOnWritability( redir->anio_out );
+			}
+			else
+			{
+				dlog( kDebugLevelError, "AsyncIORedirect: error writing to output (%d)\n", errno );
+				redir->output_failed = true;
+				(redir->callback)( kAIO_REDIRECT_OUTPUT_ERROR_EVENT, redir, redir->callback_data );
+			}
 		}
 	}
-
 }
 
 static void redirect_AsyncIOEvent( int eventID, AsyncIO anio, int fd, void * userData )
@@ -1466,6 +6584,7 @@ static void redirect_AsyncIOEvent( int eventID, AsyncIO anio, int fd, void * use
 			{
 				check( fd == redir->fd_in );
 
+				redir->read_pending = false;
 				(redir->callback)( kAIO_REDIRECT_DATA_READY, redir, redir->callback_data );
 
 				redirect_Pump( redir );
@@ -1476,6 +6595,7 @@ static void redirect_AsyncIOEvent( int eventID, AsyncIO anio, int fd, void * use
 			{
 				check( fd == redir->fd_out );
 
+				redir->write_pending = false;
 				redirect_Pump( redir );
 			}
 			break;
@@ -1492,17 +6612,63 @@ static void redirect_AsyncIOEvent( int eventID, AsyncIO anio, int fd, void * use
 	}
 }
 
+// 0 for either means the default -- three quarters and a quarter of the way up
+static void redirect_SetWatermarks( AsyncRedirectIO redir, size_t lowWater, size_t highWater )
+{
+	redir->low_water_asked = lowWater;
+	redir->high_water_asked = highWater;
+
+	redir->high_water = ( highWater > 0 ) ? Minimum( highWater, redir->capacity ) : ( redir->capacity / 4 ) * 3;
+	redir->low_water = ( lowWater > 0 ) ? lowWater : redir->capacity / 4;
+
+	if ( redir->low_water >= redir->high_water )
+	{
+		redir->low_water = redir->high_water / 2;
+	}
+}
+
 AsyncRedirectIO AsyncIO_Redirect( int fd_in, int fd_out, AsyncRedirectIOEvent callback, void * callback_data )
 {
 	AsyncRedirectIO result = NULL;
 	AsyncRedirectIO redir;
 	int err;
 
-	redir = (AsyncRedirectIO)calloc( 1, sizeof( *redir ) );
-	require( redir != NULL, exit );
+	redir = (AsyncRedirectIO)calloc( 1, sizeof( *redir ) );
+	require( redir != NULL, exit );
+
+	redir->callback = callback;
+	redir->callback_data = callback_data;
+
+	err = AsyncIO_RingResize( &redir->ring, kRedirectDefaultBufferSize );
+	require( err == 0, exit );
+	redir->capacity = redir->ring.size;
+
+#if TARGET_OS_LINUX
+	redir->pipe_read = kInvalidFD;
+	redir->pipe_write = kInvalidFD;
+
+	// if we can't get a pipe, copying still works
+	if ( redirect_CanSplice( fd_in ) && redirect_CanSplice( fd_out ) )
+	{
+		int fds[2];
+
+		if ( pipe2( fds, O_NONBLOCK | O_CLOEXEC ) == 0 )
+		{
+			redir->pipe_read = fds[0];
+			redir->pipe_write = fds[1];
+			redir->splicing = true;
+
+			fcntl( redir->pipe_write, F_SETPIPE_SZ, (int)redir->ring.size );
+			err = fcntl( redir->pipe_write, F_GETPIPE_SZ );
+			if ( err > 0 )
+			{
+				redir->capacity = err;
+			}
+		}
+	}
+#endif
 
-	redir->callback = callback;
-	redir->callback_data = callback_data;
+	redirect_SetWatermarks( redir, 0, 0 );
 
 	redir->fd_in = fd_in;
 	redir->anio_in = AsyncIO_NewConnection( fd_in, redirect_AsyncIOEvent, redir );
@@ -1510,8 +6676,7 @@ AsyncRedirectIO AsyncIO_Redirect( int fd_in, int fd_out, AsyncRedirectIOEvent ca
 
 	err = AsyncIO_NotifyOnReadability( redir->anio_in );
 	require( err == 0, exit );
-
-	redir->state = REDIR_STATE_WAITING_FOR_DATA;
+	redir->read_pending = true;
 
 	redir->fd_out = fd_out;
 	redir->anio_out = AsyncIO_NewConnection( fd_out, redirect_AsyncIOEvent, redir );
@@ -1526,18 +6691,66 @@ exit:
 	{
 		ForgetAsyncIO( &redir->anio_in, 0 );
 		ForgetAsyncIO( &redir->anio_out, 0 );
+#if TARGET_OS_LINUX
+		ForgetFD( &redir->pipe_read );
+		ForgetFD( &redir->pipe_write );
+#endif
+		ForgetMem( &redir->ring.data );
 		ForgetMem( &redir );
 	}
 
 	return result;
 }
 
+int AsyncIO_SetRedirectBuffer( AsyncRedirectIO redir, size_t size, size_t lowWater, size_t highWater )
+{
+	int result = -1;
+	int err;
+
+	require( redir != NULL, exit );
+	require( size > 0, exit );
+
+	// only while it's empty
+	require( redir->num_in_buffer == 0, exit );
+
+	err = AsyncIO_RingResize( &redir->ring, size );
+	require( err == 0, exit );
+	redir->capacity = size;
+
+#if TARGET_OS_LINUX
+	if ( redir->splicing )
+	{
+		// rounded up to pages by the kernel
+		fcntl( redir->pipe_write, F_SETPIPE_SZ, (int)size );
+		err = fcntl( redir->pipe_write, F_GETPIPE_SZ );
+		if ( err > 0 )
+		{
+			redir->capacity = err;
+		}
+	}
+#endif
+
+	redirect_SetWatermarks( redir, lowWater, highWater );
+	redir->input_paused = false;
+
+	result = 0;
+
+exit:
+
+	return result;
+}
+
 void AsyncIO_ReleaseRedirect( AsyncRedirectIO redir, bool closeIn, bool closeOut )
 {
 	require( redir != NULL, exit );
 
 	ForgetAsyncIO( &redir->anio_in, closeIn );
 	ForgetAsyncIO( &redir->anio_out, closeOut );
+#if TARGET_OS_LINUX
+	ForgetFD( &redir->pipe_read );
+	ForgetFD( &redir->pipe_write );
+#endif
+	ForgetMem( &redir->ring.data );
 	ForgetMem( &redir );
 
 exit:
@@ -1655,7 +6868,7 @@ static void 	AsyncIOTestCallback( int eventID, AsyncIO anio, int fd, void * user
 		case kAIO_CONNECTION_CLOSED:
 			{
 				dlog( kDebugLevelTrace, "connection closed\n" );
-				AsyncIO_Release( anio );
+				AsyncIO_Release( anio, true );
 			}
 			break;
 
@@ -1667,8 +6880,8 @@ static void 	AsyncIOTestCallback( int eventID, AsyncIO anio, int fd, void * user
 				
 				if ( connection->client )
 				{
-					connection->output_buffer = strdup( "this is a message\n" );
-					connection->output_buffer_size = strlen( connection->output_buffer );
+					connection->output_buffer = (uint8_t*)strdup( "this is a message\n" );
+					connection->output_buffer_size = strlen( (char*)connection->output_buffer );
 					connection->output_buffer_pos = 0;
 				}
 				
@@ -1745,13 +6958,521 @@ exit:
 	;
 }
 
+struct anio_test_timer
+{
+	AsyncIOTimerEntry	entry;		// first, so the handler can get back to the rest
+	uint64_t			firedAt;
+	int					order;
+};
+
+static int anioTestTimersFired;
+
+static void		AsyncIOTest_TimerHandler( AsyncIOLoop loop, AsyncIOTimerEntry *entry )
+{
+	struct anio_test_timer *t = (struct anio_test_timer*)entry;
+
+	t->firedAt = loop->timers.current;
+	t->order = anioTestTimersFired++;
+}
+
+// the wheel on a made up clock -- everything has to fire on the millisecond it's due, including
+//	the ones that land right on a level boundary and get there by cascading, and in order
+static int		AsyncIOTest_TimerWheel( void )
+{
+	static const uint64_t offsets[] = { 4097, 64, 1, 262144, 63, 4096, 65, 300000, 128, 8192, 127, 4095, 262143, 4160 };
+	struct anio_test_timer timers[ sizeof( offsets ) / sizeof( offsets[0] ) ];
+	const int count = (int)( sizeof( offsets ) / sizeof( offsets[0] ) );
+	const uint64_t base = 1ULL << 20;		// on every level's boundary
+	int result = -1;
+	AsyncIOLoop loop;
+	uint64_t now;
+	int i, j;
+
+	loop = AsyncIOLoop_Create();
+	require( loop != NULL, exit );
+
+	loop->timers.current = base;
+	anioTestTimersFired = 0;
+
+	memset( timers, 0, sizeof( timers ) );
+	for ( i = 0; i < count; i++ )
+	{
+		timers[i].entry.handler = AsyncIOTest_TimerHandler;
+		timers[i].order = -1;
+		AsyncIO_ArmTimerEntry( loop, &timers[i].entry, base + offsets[i] );
+	}
+
+	// a millisecond at a time, so a late one can't hide behind a big step
+	for ( now = base + 1; now <= base + 300001; now++ )
+	{
+		AsyncIO_RunTimerWheel( loop, now );
+	}
+
+	require( anioTestTimersFired == count, exit );
+	for ( i = 0; i < count; i++ )
+	{
+		if ( timers[i].firedAt != timers[i].entry.expires ) { dlog( kDebugLevelError, "timer due at +%llu fired at +%llu\n", (unsigned long long)offsets[i], (unsigned long long)( timers[i].firedAt - base ) ); }
+		require( timers[i].firedAt == timers[i].entry.expires, exit );
+
+		for ( j = 0; j < count; j++ )
+		{
+			require( ( offsets[i] >= offsets[j] ) || ( timers[i].order < timers[j].order ), exit );
+		}
+	}
+
+	result = 0;
+
+exit:
+
+	ForgetAsyncIOLoop( &loop );
+
+	return result;
+}
+
+#if TARGET_OS_UNIXLIKE && !ASYNC_NETIO_USE_SELECT
+#define kAnioTestPostThreads		8
+#define kAnioTestPostsPerThread		20000
+
+static AsyncIOLoop anioTestPostLoop;
+static int anioTestPostsRun;
+
+static void		AsyncIOTest_PostedTask( void * context )
+{
+	(void)context;
+
+	if ( ++anioTestPostsRun == ( kAnioTestPostThreads * kAnioTestPostsPerThread ) )
+	{
+		AsyncIOLoop_Stop( anioTestPostLoop );
+	}
+}
+
+static void *	AsyncIOTest_PostThread( void * arg )
+{
+	int i;
+
+	(void)arg;
+
+	for ( i = 0; i < kAnioTestPostsPerThread; i++ )
+	{
+		// (it only fails when it's out of memory)
+		while ( AsyncIOLoop_Post( anioTestPostLoop, AsyncIOTest_PostedTask, NULL ) != 0 )
+			;
+	}
+
+	return NULL;
+}
+
+// lots of threads posting at once -- every task has to run exactly once, on the loop, and the
+//	doorbell should have rung far fewer times than there were posts
+static int		AsyncIOTest_PostFromThreads( void )
+{
+	int result = -1;
+	pthread_t threads[kAnioTestPostThreads];
+	int started = 0;
+	AsyncIOStats stats;
+	int err;
+
+	anioTestPostLoop = AsyncIOLoop_Create();
+	require( anioTestPostLoop != NULL, exit );
+	anioTestPostsRun = 0;
+
+	err = AsyncIOLoop_EnableStats( anioTestPostLoop, true );
+	require( err == 0, exit );
+
+	for ( started = 0; started < kAnioTestPostThreads; started++ )
+	{
+		err = pthread_create( &threads[started], NULL, AsyncIOTest_PostThread, NULL );
+		require( err == 0, exit );
+	}
+
+	err = AsyncIOLoop_Run( anioTestPostLoop, true );
+	require( err == 0, exit );
+
+	require( anioTestPostsRun == ( kAnioTestPostThreads * kAnioTestPostsPerThread ), exit );
+
+	err = AsyncIOLoop_GetStats( anioTestPostLoop, &stats, false );
+	require( err == 0, exit );
+	dlog( kDebugLevelTrace, "%d posts, %llu wakeups\n", anioTestPostsRun, (unsigned long long)stats.wakeups );
+	require( stats.wakeups < (uint64_t)anioTestPostsRun, exit );
+
+	result = 0;
+
+exit:
+
+	while ( started > 0 )
+	{
+		pthread_join( threads[--started], NULL );
+	}
+	ForgetAsyncIOLoop( &anioTestPostLoop );
+
+	return result;
+}
+#endif
+
+#if TARGET_OS_UNIXLIKE && !ASYNC_NETIO_USE_SELECT
+#define kAnioTestSendFileSize		( ( kAsyncIOSendFileBurst * 3 ) / 2 + 17 )	// more than one burst
+#define kAnioTestChainedSize		1000
+
+static FILE *anioTestChainedFile;
+static int anioTestSendFilesDone;
+static int anioTestSendFileError;
+
+static void		AsyncIOTest_SendFileCallback( int eventID, AsyncIO anio, int fd, void * userData )
+{
+	(void)eventID; (void)anio; (void)fd; (void)userData;
+}
+
+static void		AsyncIOTest_SendFileNoop( void * context )
+{
+	(void)context;
+}
+
+static void		AsyncIOTest_ChainedDone( AsyncIO anio, int fd, off_t sent, int err, void * userData )
+{
+	(void)anio; (void)fd; (void)userData;
+
+	if ( ( err != 0 ) || ( sent != kAnioTestChainedSize ) )
+		anioTestSendFileError = -1;
+	anioTestSendFilesDone++;
+}
+
+static void		AsyncIOTest_SendFileDone( AsyncIO anio, int fd, off_t sent, int err, void * userData )
+{
+	(void)fd; (void)userData;
+
+	if ( ( err != 0 ) || ( sent != kAnioTestSendFileSize ) )
+		anioTestSendFileError = -1;
+	anioTestSendFilesDone++;
+
+	// the next file waits for "mid" (written while this one was going), but not for "tail"
+	if ( AsyncIO_SendFile( anio, fileno( anioTestChainedFile ), 0, 0, AsyncIOTest_ChainedDone, NULL ) != 0 )
+		anioTestSendFileError = -1;
+	if ( AsyncIO_Write( anio, "tail", 4 ) != 4 )
+		anioTestSendFileError = -1;
+}
+
+static FILE *	AsyncIOTest_MakeFile( size_t size, char first, uint8_t *expected )
+{
+	FILE *f = tmpfile();
+	size_t i;
+
+	if ( f == NULL )
+		return NULL;
+
+	for ( i = 0; i < size; i++ )
+	{
+		expected[i] = (uint8_t)( first + ( i % 26 ) );
+		fputc( expected[i], f );
+	}
+	fflush( f );
+
+	return f;
+}
+
+// head, a file more than a burst long, mid (written while it's going), a second file started from
+//	the first's completion, and tail (written right after that) -- they have to come out in that
+//	order, on a one-shot connection and on a persistent one that had already seen the socket writable
+static int		AsyncIOTest_SendFileOn( bool persistent )
+{
+	int result = -1;
+	AsyncIOLoop loop, previous = NULL;
+	AsyncIO anio = NULL;
+	FILE *file = NULL;
+	uint8_t *expected = NULL, *got = NULL;
+	size_t total = 4 + kAnioTestSendFileSize + 3 + kAnioTestChainedSize + 4;
+	size_t have = 0;
+	uint64_t giveUp;
+	int pair[2] = { kInvalidFD, kInvalidFD };
+	ssize_t n;
+	int err, i;
+
+	anioTestChainedFile = NULL;
+	anioTestSendFilesDone = 0;
+	anioTestSendFileError = 0;
+
+	loop = AsyncIOLoop_Create();
+	require( loop != NULL, exit );
+	previous = AsyncIOLoop_SetCurrent( loop );
+
+	expected = malloc( total );
+	got = malloc( total );
+	require( ( expected != NULL ) && ( got != NULL ), exit );
+
+	memcpy( expected, "head", 4 );
+	file = AsyncIOTest_MakeFile( kAnioTestSendFileSize, 'a', expected + 4 );
+	require( file != NULL, exit );
+	memcpy( expected + 4 + kAnioTestSendFileSize, "mid", 3 );
+	anioTestChainedFile = AsyncIOTest_MakeFile( kAnioTestChainedSize, 'A', expected + 4 + kAnioTestSendFileSize + 3 );
+	require( anioTestChainedFile != NULL, exit );
+	memcpy( expected + total - 4, "tail", 4 );
+
+	err = socketpair( AF_UNIX, SOCK_STREAM, 0, pair );
+	require( err == 0, exit );
+	fcntl( pair[1], F_SETFL, fcntl( pair[1], F_GETFL, 0 ) | O_NONBLOCK );
+
+	anio = AsyncIO_NewConnection( pair[0], AsyncIOTest_SendFileCallback, NULL );
+	require( anio != NULL, exit );
+	pair[0] = kInvalidFD;
+
+	require( AsyncIO_Write( anio, "head", 4 ) == 4, exit );
+
+	if ( persistent )
+	{
+		err = AsyncIO_SetPersistentNotifications( anio, true );
+		require( err == 0, exit );
+		err = AsyncIO_NotifyOnWritability( anio );
+		require( err == 0, exit );
+
+		// use up the edges -- the one from arming, and the one from the read making room
+		for ( i = 0; i < 3; i++ )
+		{
+			AsyncIOLoop_Post( loop, AsyncIOTest_SendFileNoop, NULL );
+			err = AsyncIOLoop_Run( loop, false );
+			require( err == 0, exit );
+
+			while ( ( n = read( pair[1], got + have, total - have ) ) > 0 )
+				have += n;
+		}
+		require( have == 4, exit );
+	}
+
+	err = AsyncIO_SendFile( anio, fileno( file ), 0, 0, AsyncIOTest_SendFileDone, NULL );
+	require( err == 0, exit );
+	require( AsyncIO_Write( anio, "mid", 3 ) == 3, exit );
+
+	giveUp = AsyncIO_Milliseconds() + 10000;
+	while ( ( have < total ) && ( AsyncIO_Milliseconds() < giveUp ) )
+	{
+		AsyncIOLoop_Post( loop, AsyncIOTest_SendFileNoop, NULL );
+		err = AsyncIOLoop_Run( loop, false );
+		require( err == 0, exit );
+
+		while ( ( have < total ) && ( ( n = read( pair[1], got + have, total - have ) ) > 0 ) )
+			have += n;
+	}
+
+	dlog( kDebugLevelTrace, "sendfile (%s): %zu of %zu bytes\n", persistent ? "persistent" : "one shot", have, total );
+	require( have == total, exit );
+	require( ( anioTestSendFilesDone == 2 ) && ( anioTestSendFileError == 0 ), exit );
+	require( memcmp( got, expected, total ) == 0, exit );
+
+	result = 0;
+
+exit:
+
+	ForgetAsyncIO( &anio, true );
+	ForgetFD( &pair[0] );
+	ForgetFD( &pair[1] );
+	if ( file != NULL )
+		fclose( file );
+	if ( anioTestChainedFile != NULL )
+		fclose( anioTestChainedFile );
+	anioTestChainedFile = NULL;
+	ForgetMem( &expected );
+	ForgetMem( &got );
+	if ( loop != NULL )
+	{
+		AsyncIOLoop_SetCurrent( previous );
+		ForgetAsyncIOLoop( &loop );
+	}
+
+	return result;
+}
+
+static int		AsyncIOTest_SendFile( void )
+{
+	int err;
+
+	err = AsyncIOTest_SendFileOn( false );
+#if ASYNC_NETIO_USE_KQUEUE || ASYNC_NETIO_USE_EPOLL
+	if ( err == 0 )
+		err = AsyncIOTest_SendFileOn( true );
+#endif
+
+	return err;
+}
+#endif
+
+#if ASYNC_NETIO_USE_POLL
+#define kAnioTestPollConnections	32
+
+struct anio_test_poll
+{
+	AsyncIO		anio;
+	int			peer;
+	int			calls;
+	bool		released;
+};
+
+static struct anio_test_poll anioTestPoll[kAnioTestPollConnections];
+static bool anioTestPollInconsistent;
+
+static void		AsyncIOTest_PollCallback( int eventID, AsyncIO anio, int fd, void * userData )
+{
+	struct anio_test_poll *c = (struct anio_test_poll*)userData;
+	uint8_t byte;
+	int i;
+
+	(void)fd;
+
+	if ( eventID != kAIO_DATA_AVAILABLE )
+		return;
+
+	c->calls++;
+	(void)AsyncIO_Read( anio, &byte, sizeof( byte ) );
+
+	// the first one in takes out every other one still waiting in this batch -- each of those
+	//	swaps the end of the dense array into its place
+	for ( i = 1; i < kAnioTestPollConnections; i += 2 )
+	{
+		if ( ( &anioTestPoll[i] != c ) && !anioTestPoll[i].released && ( anioTestPoll[i].calls == 0 ) )
+		{
+			ForgetAsyncIO( &anioTestPoll[i].anio, true );
+			anioTestPoll[i].released = true;
+		}
+	}
+
+	// whatever got moved has to know where it is now
+	for ( i = 0; i < anio->loop->numPollFDs; i++ )
+	{
+		AsyncIO owner = anio->loop->pollOwners[i];
+		if ( ( owner->pollIndex != i ) || ( anio->loop->pollFDs[i].fd != owner->fd ) )
+			anioTestPollInconsistent = true;
+	}
+}
+
+// releasing connections from inside a callback, while the rest of the batch is still to come --
+//	nobody left may be skipped or called twice, and the array has to stay dense and consistent
+static int		AsyncIOTest_PollSwapRemove( void )
+{
+	int result = -1;
+	AsyncIOLoop loop, previous = NULL;
+	int pair[2];
+	int i, err, pass, live;
+
+	memset( anioTestPoll, 0, sizeof( anioTestPoll ) );
+	anioTestPollInconsistent = false;
+	for ( i = 0; i < kAnioTestPollConnections; i++ )
+	{
+		anioTestPoll[i].peer = kInvalidFD;
+	}
+
+	loop = AsyncIOLoop_Create();
+	require( loop != NULL, exit );
+	previous = AsyncIOLoop_SetCurrent( loop );
+
+	for ( i = 0; i < kAnioTestPollConnections; i++ )
+	{
+		err = socketpair( AF_UNIX, SOCK_STREAM, 0, pair );
+		require( err == 0, exit );
+		anioTestPoll[i].peer = pair[1];
+
+		anioTestPoll[i].anio = AsyncIO_NewConnection( pair[0], AsyncIOTest_PollCallback, &anioTestPoll[i] );
+		require_action( anioTestPoll[i].anio != NULL, exit, close( pair[0] ) );
+
+		err = AsyncIO_NotifyOnReadability( anioTestPoll[i].anio );
+		require( err == 0, exit );
+
+		require( write( anioTestPoll[i].peer, "x", 1 ) == 1, exit );
+	}
+
+	// they're all ready at once, but there may be more than one pass to get through them
+	for ( pass = 0; pass < 10; pass++ )
+	{
+		for ( i = 0, live = 0; i < kAnioTestPollConnections; i++ )
+		{
+			if ( !anioTestPoll[i].released && ( anioTestPoll[i].calls == 0 ) )
+				live++;
+		}
+		if ( live == 0 )
+			break;
+
+		err = AsyncIOLoop_Run( loop, false );
+		require( err == 0, exit );
+	}
+
+	for ( i = 0, live = 0; i < kAnioTestPollConnections; i++ )
+	{
+		require( anioTestPoll[i].calls == ( anioTestPoll[i].released ? 0 : 1 ), exit );
+		if ( !anioTestPoll[i].released )
+			live++;
+	}
+	require( live < kAnioTestPollConnections, exit );
+	require( !anioTestPollInconsistent, exit );
+
+	// nothing's armed any more (one shot), so only the wakeup is left
+	require( loop->numPollFDs == 1, exit );
+	require( ( loop->pollOwners[0] == loop->wakeup ) && ( loop->wakeup->pollIndex == 0 ), exit );
+
+	// and the ones that are left still work
+	for ( i = 0; i < kAnioTestPollConnections; i++ )
+	{
+		if ( anioTestPoll[i].released )
+			continue;
+
+		err = AsyncIO_NotifyOnReadability( anioTestPoll[i].anio );
+		require( err == 0, exit );
+		require( write( anioTestPoll[i].peer, "x", 1 ) == 1, exit );
+	}
+	for ( i = 0; i < loop->numPollFDs; i++ )
+	{
+		require( ( loop->pollOwners[i]->pollIndex == i ) && ( loop->pollFDs[i].fd == loop->pollOwners[i]->fd ), exit );
+	}
+
+	for ( pass = 0; pass < 10; pass++ )
+	{
+		err = AsyncIOLoop_Run( loop, false );
+		require( err == 0, exit );
+		if ( loop->numPollFDs == 1 )
+			break;
+	}
+
+	for ( i = 0; i < kAnioTestPollConnections; i++ )
+	{
+		require( anioTestPoll[i].calls == ( anioTestPoll[i].released ? 0 : 2 ), exit );
+	}
+
+	result = 0;
+
+exit:
+
+	for ( i = 0; i < kAnioTestPollConnections; i++ )
+	{
+		ForgetAsyncIO( &anioTestPoll[i].anio, true );
+		ForgetFD( &anioTestPoll[i].peer );
+	}
+	if ( loop != NULL )
+	{
+		AsyncIOLoop_SetCurrent( previous );
+		ForgetAsyncIOLoop( &loop );
+	}
+
+	return result;
+}
+#endif
 
 void	AsyncIOTests( void )
 {
 	int fd, err, flags;
 
 	dlog_set_level( kDebugLevelTrace );
-	AsyncIO_Initialize();
+	AsyncIO_Initialize( 0 );
+
+	err = AsyncIOTest_TimerWheel();
+	require( err == 0, exit );
+
+#if TARGET_OS_UNIXLIKE && !ASYNC_NETIO_USE_SELECT
+	err = AsyncIOTest_PostFromThreads();
+	require( err == 0, exit );
+
+	err = AsyncIOTest_SendFile();
+	require( err == 0, exit );
+#endif
+
+#if ASYNC_NETIO_USE_POLL
+	err = AsyncIOTest_PollSwapRemove();
+	require( err == 0, exit );
+#endif
 
 	fd = socket( AF_INET6, SOCK_STREAM, IPPROTO_TCP );
 	require( fd >= 0, exit );
@@ -40,6 +40,8 @@
 #if TARGET_OS_UNIXLIKE
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 
 #ifdef __cplusplus
@@ -48,6 +50,7 @@ extern "C" {
 
 
 typedef struct OpaqueAsyncIO *AsyncIO;
+typedef struct OpaqueAsyncIOLoop *AsyncIOLoop;
 
 #define kAIO_NEW_CONNECTION			1
 #define kAIO_CONNECTION_CLOSED		2
@@ -62,6 +65,16 @@ typedef struct OpaqueAsyncIO *AsyncIO;
 
 #define kAIO_SIGNAL_DELIVERED		7	// fd in callback is actually the signal
 
+#define kAIO_READ_COMPLETED			8	// completion mode only -- use AsyncIO_GetCompletedRead() inside the callback
+#define kAIO_WRITE_COMPLETED		9	// completion mode only -- one per AsyncIO_SubmitWrite()
+
+#define kAIO_CONNECTION_ACCEPTED	10	// AsyncIO_SetAcceptBatch() listeners -- fd in callback is the new connection
+
+#define kAIO_DATAGRAMS_RECEIVED		11	// datagram sockets -- use AsyncIO_GetReceivedDatagrams() inside the callback
+
+#define kAIO_IDLE_TIMEOUT			12	// AsyncIO_SetIdleTimeout() -- nothing happened on the connection for that long
+#define kAIO_DEADLINE_EXPIRED		13	// AsyncIO_SetDeadline()
+
 
 typedef void ( *AsyncIOEvent )( int eventID, AsyncIO anio, int fd, void * userData );
 
@@ -80,20 +93,221 @@ int			AsyncIO_NotifyOnReadability( AsyncIO aio );
 int			AsyncIO_NotifyOnWritability( AsyncIO aio );
 #define 	AsyncIO_NotifyWhenConnected( aio )		AsyncIO_NotifyOnWritability( aio )
 
+// for long-lived, chatty connections -- once NotifyOnReadability/Writability have been called they
+//	stay registered (edge-triggered), and the callback gets each new edge without re-arming.  that
+//	means reading (or writing) until EAGAIN, or you won't hear about what's left.  call it before
+//	arming anything; select (FreeRTOS) and poll can't do it.
+int			AsyncIO_SetPersistentNotifications( AsyncIO aio, bool persistent );
+
+// for connection storms -- instead of kAIO_NEW_CONNECTION, the listener's backlog is drained for
+//	it (accept4() where there is one), up to budget connections per wakeup, and the callback gets
+//	kAIO_CONNECTION_ACCEPTED for each.  the descriptor is already non-blocking and close-on-exec,
+//	and it's yours: AsyncIO_NewAcceptedConnection() skips the fcntl()s AsyncIO_NewConnection()
+//	makes.  a budget of 0 goes back to kAIO_NEW_CONNECTION.
+int			AsyncIO_SetAcceptBatch( AsyncIO listener, int budget );
+AsyncIO		AsyncIO_NewAcceptedConnection( int fd, AsyncIOEvent eventCallback, void * userData );
+
+// timeouts the loop keeps for a connection, on one timer entry -- kAIO_IDLE_TIMEOUT when nothing's
+//	been delivered to it for milliseconds (and again each period it stays idle), and
+//	kAIO_DEADLINE_EXPIRED once, milliseconds from now no matter what.  activity is only stamped as
+//	it happens, so they can be up to a wakeup late.  0 turns either one off.
+int			AsyncIO_SetIdleTimeout( AsyncIO aio, uint32_t milliseconds );
+int			AsyncIO_SetDeadline( AsyncIO aio, uint32_t milliseconds );
+
+// buffered streams -- reading and writing a connection through these goes through a pair of ring
+//	buffers (allocated on first use).  a write takes what the kernel won't and queues it, and the
+//	queue drains on its own; once there's a queue, kAIO_READY_FOR_WRITE only arrives after it's
+//	empty, and only if you asked.  read until it fails with EWOULDBLOCK -- it can be holding data
+//	the kernel has already handed over.
+int			AsyncIO_SetStreamBuffers( AsyncIO aio, size_t inputSize, size_t outputSize );	// before there's anything in them
+ssize_t		AsyncIO_Read( AsyncIO aio, void *buffer, size_t length );			// 0 at EOF
+ssize_t		AsyncIO_Write( AsyncIO aio, const void *data, size_t length );		// returns number of bytes accepted
+#if TARGET_OS_UNIXLIKE
+ssize_t		AsyncIO_WriteVector( AsyncIO aio, const struct iovec *iov, int count );
+#endif
+size_t		AsyncIO_GetQueuedOutput( AsyncIO aio );
+
+#if TARGET_OS_UNIXLIKE
+// streams length bytes of the file (0 for the rest of it) out the connection with sendfile(), as
+//	the socket has room -- after anything already queued by AsyncIO_Write(), and ahead of anything
+//	written after.  one at a time; the completion is called from the loop, with how much went out
+//	and 0 or an errno.  releasing the connection abandons it without calling the completion.
+typedef void ( *AsyncIOSendFileCompletion )( AsyncIO aio, int fd, off_t sent, int err, void * userData );
+
+int			AsyncIO_SendFile( AsyncIO aio, int fd, off_t offset, size_t length, AsyncIOSendFileCompletion completion, void * userData );
+
+// datagram (UDP) sockets -- watched for reads from the start, and each wakeup drains them in
+//	batches of up to batchSize packets (recvmmsg() on Linux) into buffers of maxPacket bytes that
+//	are allocated up front.  the callback gets kAIO_DATAGRAMS_RECEIVED for each batch, and
+//	AsyncIO_GetReceivedDatagrams() hands it back (returns the count, only good until the callback
+//	returns).  sends are copied into a queue of batchSize slots and all go to the kernel together
+//	(sendmmsg()) before the loop next waits, or with AsyncIO_FlushDatagrams() -- once the queue's
+//	full and the kernel won't take any, it fails with EWOULDBLOCK.  to is NULL on a connected
+//	socket.  kAIO_READY_FOR_WRITE, if asked for, waits until the queue is empty.  not on select.
+typedef struct
+{
+	const uint8_t *				data;
+	size_t						length;
+	bool						truncated;		// it was bigger than maxPacket
+	const struct sockaddr *		from;
+	socklen_t					fromLength;
+} AsyncIODatagram;
+
+AsyncIO		AsyncIO_NewDatagramSocket( int fd, size_t maxPacket, int batchSize, AsyncIOEvent eventCallback, void * userData );
+int			AsyncIO_GetReceivedDatagrams( AsyncIO aio, const AsyncIODatagram **outDatagrams );
+int			AsyncIO_SendDatagram( AsyncIO aio, const void * data, size_t length, const struct sockaddr *to, socklen_t toLength );
+int			AsyncIO_FlushDatagrams( AsyncIO aio );
+#endif
+
 int 			AsyncIO_Run( bool keepRunning );
 
+// every AsyncIO_New* call binds the new object to the calling thread's current loop -- that's the
+//	default loop (created by AsyncIO_Initialize) unless the thread has set its own, and a loop is
+//	current on its thread while AsyncIOLoop_Run() is running it.  an AsyncIO may only be used
+//	from the thread running its loop.
+AsyncIOLoop		AsyncIOLoop_Create( void );
+void			AsyncIOLoop_Destroy( AsyncIOLoop loop );		// releases any AsyncIOs still on it (and closes their descriptors)
+int				AsyncIOLoop_Run( AsyncIOLoop loop, bool keepRunning );
+
+int				AsyncIOLoop_Stop( AsyncIOLoop loop );				// safe from any thread, makes AsyncIOLoop_Run() return
+
+// hands function( context ) to the loop, to be called on its thread -- safe (and cheap) from any
+//	thread, a burst of posts only wakes the loop once.  AsyncIO_Post() goes to the default loop.
+//	anything still waiting when the loop is destroyed is dropped.  not on select (FreeRTOS).
+typedef void ( *AsyncIOTaskFunction )( void * context );
+
+int				AsyncIOLoop_Post( AsyncIOLoop loop, AsyncIOTaskFunction function, void * context );
+int				AsyncIO_Post( AsyncIOTaskFunction function, void * context );
+
+// how many events AsyncIOLoop_Run() pulls from the kernel per wait (0 for the default) -- with
+//	adaptive, it starts small and grows (up to maxEvents) while the kernel keeps filling it.
+//	not from inside a callback.
+int				AsyncIOLoop_SetBatchSize( AsyncIOLoop loop, int maxEvents, bool adaptive );
+
+// instrumentation -- off until enabled (and then only the counting costs anything).  the times
+//	are microseconds; each histogram's bucket 0 counts zeros, and bucket n counts values in
+//	[ 2^(n-1), 2^n ), with the last one taking everything bigger.  the loop lag is how long it
+//	takes to get back to waiting after waking up.  read them from the loop's own thread (post
+//	a task to do it from anywhere else); reset zeroes them after the copy.
+#define kAsyncIOStatsBuckets		32
+#define kAsyncIOStatsEventTypes		14			// callbackLatency is indexed by eventID
+
+typedef struct
+{
+	uint64_t			count;
+	uint64_t			total;
+	uint64_t			max;
+	uint64_t			buckets[kAsyncIOStatsBuckets];
+} AsyncIOHistogram;
+
+typedef struct
+{
+	uint64_t			wakeups;
+	uint64_t			events;
+	uint64_t			usBlocked;			// waiting in the kernel
+	uint64_t			usInCallbacks;
+	uint64_t			overloads;			// times the overload policy paused the listeners
+
+	AsyncIOHistogram	eventsPerWakeup;
+	AsyncIOHistogram	callbackLatency[kAsyncIOStatsEventTypes];
+	AsyncIOHistogram	timerLateness;		// past the deadline (leeway included)
+	AsyncIOHistogram	loopLag;
+} AsyncIOStats;
+
+int				AsyncIOLoop_EnableStats( AsyncIOLoop loop, bool enable );		// disabling throws them away
+int				AsyncIOLoop_GetStats( AsyncIOLoop loop, AsyncIOStats *outStats, bool reset );
+int				AsyncIO_GetStats( AsyncIOStats *outStats, bool reset );		// the current loop
+
+// overload protection -- once the loop lag (smoothed, in microseconds) goes over lagHigh, or the
+//	outstanding work (open connections plus AsyncIO_Offload() work) goes over outstandingHigh,
+//	the loop's listeners stop getting kAIO_NEW_CONNECTION, and pending connections wait in the
+//	kernel's backlog.  they're watched again once everything is back under its low mark.
+//	a high of 0 ignores that measure; both 0 turns it off.  only while AsyncIOLoop_Run() drives
+//	the loop, and not on select (FreeRTOS).
+int				AsyncIOLoop_SetOverloadPolicy( AsyncIOLoop loop, uint32_t lagHigh, uint32_t lagLow, uint32_t outstandingHigh, uint32_t outstandingLow );
+bool			AsyncIOLoop_IsOverloaded( AsyncIOLoop loop );
+
+AsyncIOLoop		AsyncIO_GetLoop( AsyncIO aio );
+AsyncIOLoop		AsyncIOLoop_GetDefault( void );
+AsyncIOLoop		AsyncIOLoop_GetCurrent( void );
+AsyncIOLoop		AsyncIOLoop_SetCurrent( AsyncIOLoop loop );		// returns the previous one, NULL reverts to the default
+
+#define ForgetAsyncIOLoop( l )		do { if ( (*l) != NULL ) { AsyncIOLoop_Destroy( (*l) ); (*l) = NULL; } } while(0)
+
+#if TARGET_OS_UNIXLIKE
+// binds numShards SO_REUSEPORT listening sockets to the same address (numShards <= 0 means one per
+//	CPU), each with its own loop and thread; the callback is called on the shard's thread, and
+//	connections accepted there belong to that shard's loop
+typedef struct OpaqueAsyncIOShardedListener *AsyncIOShardedListener;
+
+AsyncIOShardedListener	AsyncIO_NewShardedListener( const struct sockaddr *addr, socklen_t addrLen, int backlog, int numShards, AsyncIOEvent eventCallback, void * userData );
+void					AsyncIO_ReleaseShardedListener( AsyncIOShardedListener listener );		// stops and joins the shard threads
+
+#define ForgetShardedListener( l )		do { if ( (*l) != NULL ) { AsyncIO_ReleaseShardedListener( (*l) ); (*l) = NULL; } } while(0)
+
+// for blocking work (file system, big checksums) that shouldn't hold up everything else on the
+//	loop -- work( context ) runs on a pool of worker threads (4 by default), and done( context ) is
+//	called back on the calling thread's loop once it finishes.  destroying that loop first waits
+//	for any that are still out (and runs their completions).
+int				AsyncIO_Offload( AsyncIOTaskFunction work, AsyncIOTaskFunction done, void * context );
+int				AsyncIO_SetOffloadThreads( int maxThreads );
+
+// positional file I/O that won't stall the loop -- io_uring does it where it can, the offload
+//	threads otherwise.  the buffer has to stay put until the completion, which is called on the
+//	current loop (never from in here) with how much was transferred -- short only if it failed
+//	or the file ended -- and 0 or an errno.
+typedef void ( *AsyncIOFileCompletion )( int fd, ssize_t transferred, int err, void * userData );
+
+int				AsyncIO_ReadFile( int fd, void * buffer, size_t length, off_t offset, AsyncIOFileCompletion completion, void * userData );
+int				AsyncIO_WriteFile( int fd, const void * buffer, size_t length, off_t offset, AsyncIOFileCompletion completion, void * userData );
+#endif
+
 typedef struct OpaqueAsyncIOEventContext *AsyncIOEventsContext;
 int				AsyncIO_WaitForEvents( AsyncIOEventsContext *outEventsContext, struct timeval *timeout );
 int				AsyncIO_ProcessEvents( AsyncIOEventsContext outEventsContext );
 
 #if TARGET_OS_UNIXLIKE
+// on Linux these are a pidfd and a signalfd, elsewhere kqueue filters.  a process monitor fires
+//	once; a signal monitor keeps delivering until it's released, on either.  the signal's action
+//	is taken over for the whole process (ignored on kqueue, a handler that does nothing on Linux)
+//	so it never kills it -- but on Linux only threads that have it blocked leave it for the
+//	signalfd: the calling thread, and AsyncIO's own threads, do.  block it in any others you start.
+//	releasing the monitor (on the thread that made it) puts the previous action, and the calling
+//	thread's mask, back.  there's one monitor per signal -- another fails with errno set to EBUSY.
+//	built for poll() (ASYNC_NETIO_USE_POLL), they fail with errno set to ENOTSUP
 AsyncIO		AsyncIO_NewProcessMonitor( pid_t pid, AsyncIOEvent eventCallback, void * userData );
 AsyncIO		AsyncIO_NewSignalMonitor( int signalID, AsyncIOEvent eventCallback, void * userData );
+
+// a child that exits is reaped before the callback (all of them together, when several go at
+//	once), so there's no zombie and no waitpid() to make -- during kAIO_PROCESS_EXITED this hands
+//	back its waitpid()-style status.  fails if it wasn't our child to reap.
+int			AsyncIO_GetExitStatus( AsyncIO aio, int *outStatus );
+#endif
+
+#if TARGET_OS_LINUX
+// completion mode (io_uring) -- reads and writes are submitted into registered buffers and
+//	their completions are delivered through the callback, instead of notifying on readiness
+//	and making the read()/write() calls yourself; the submissions are batched, and handed
+//	to the kernel once per pass through the run loop
+//
+//	these fail with errno set to ENOTSUP if the kernel doesn't support io_uring
+int			AsyncIO_StartCompletionReads( AsyncIO aio );
+int			AsyncIO_StopCompletionReads( AsyncIO aio );
+int			AsyncIO_GetCompletedRead( AsyncIO aio, const void **outData, size_t *outLength );	// only valid during kAIO_READ_COMPLETED
+ssize_t		AsyncIO_SubmitWrite( AsyncIO aio, const void *data, size_t length );	// returns number of bytes accepted
 #endif
 
 // we can do one to deliver timers
 AsyncIO		AsyncIO_NewTimer( /*uint32_t milliseconds, */AsyncIOEvent eventCallback, void * userData );
 int			AsyncIO_EnableTimer( AsyncIO timer, uint32_t milliseconds );
+
+// for timers that don't need to be exact (keepalives, idle checks) -- it fires up to leeway ms
+//	late, picked so that timers with overlapping windows fire together and share a wakeup
+int			AsyncIO_EnableTimerWithLeeway( AsyncIO timer, uint32_t milliseconds, uint32_t leeway );
+
+// fires every interval ms until it's disabled (or re-enabled) -- on a fixed schedule, so it doesn't
+//	drift, and it skips any it falls a whole interval behind on rather than firing them back to back
+int			AsyncIO_EnableRepeatingTimer( AsyncIO timer, uint32_t interval, uint32_t leeway );
 int			AsyncIO_DisableTimer( AsyncIO timer );
 
 
@@ -112,6 +326,11 @@ typedef void (*AsyncRedirectIOEvent)( int eventID, AsyncRedirectIO redir, void *
 AsyncRedirectIO AsyncIO_Redirect( int fd_in, int fd_out, AsyncRedirectIOEvent callback, void * callback_data );
 void AsyncIO_ReleaseRedirect( AsyncRedirectIO redir, bool closeIn, bool closeOut );
 
+// how much can be in flight between the two sides (64K by default), and where input stops
+//	(highWater) and starts again (lowWater) while the output catches up -- 0 for either picks
+//	three quarters and a quarter of the size.  only while nothing's buffered.
+int AsyncIO_SetRedirectBuffer( AsyncRedirectIO redir, size_t size, size_t lowWater, size_t highWater );
+
 #define ForgetRedirectIO( a, cI, cO )		do { if ( (*a) != NULL ) { AsyncIO_ReleaseRedirect( (*a), cI, cO ); (*a) = NULL; } } while(0)
 
 